@@ -0,0 +1,15 @@
+#include "tree.h"
+
+#ifndef TREE_BENCH_INTERNAL_H
+#define TREE_BENCH_INTERNAL_H
+
+/*
+    the tree.c internals bench.c rebuilds old code paths from.
+    they're the only ones with external linkage outside of unit
+    test builds, so the benches run against the same static,
+    inlined tree.c a real build gets
+*/
+tree_node* _get_root(tree* t);
+tree_node* _insert_node(tree_node* n, tree_node* c);
+
+#endif //TREE_BENCH_INTERNAL_H
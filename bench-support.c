@@ -0,0 +1,148 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../log/log.h"
+
+#include "bench-support.h"
+
+unsigned long long bench_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return bench_ns();
+#endif
+}
+
+unsigned long long bench_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long _rand_state = 88172645463325252ULL;
+
+void bench_seed(unsigned long long s) {
+    _rand_state = s ? s : 88172645463325252ULL;
+}
+
+long bench_rand() {
+    _rand_state ^= _rand_state << 13;
+    _rand_state ^= _rand_state >> 7;
+    _rand_state ^= _rand_state << 17;
+    return (long) _rand_state;
+}
+
+long* bench_random_nums(unsigned long cnt) {
+    long* nums = malloc(sizeof(long) * cnt);
+    Assert(nums != NULL, __func__, "malloc error");
+    for (unsigned long i = 0; i < cnt; i++) {
+        nums[i] = bench_rand();
+    }
+    return nums;
+}
+
+void bench_shuffle(long* nums, unsigned long cnt) {
+    for (unsigned long i = cnt - 1; i > 0 && cnt > 0; i--) {
+        unsigned long j = (unsigned long) bench_rand() % (i + 1);
+        long x = nums[i];
+        nums[i] = nums[j];
+        nums[j] = x;
+    }
+}
+
+static double _zeta(unsigned long n, double theta) {
+    double s = 0;
+    for (unsigned long i = 1; i <= n; i++) {
+        s += 1.0 / pow((double) i, theta);
+    }
+    return s;
+}
+
+void zipf_init(zipf* z, unsigned long n, double theta) {
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = _zeta(n, theta);
+    double zeta2 = _zeta(2, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+unsigned long zipf_next(zipf* z) {
+    double u = (double) ((unsigned long) bench_rand() >> 11) / (double) (1UL << 53);
+    double uz = u * z->zetan;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+    unsigned long r = (unsigned long) (z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+
+long bench_scatter(unsigned long x) {
+    // splitmix64 finalizer, a bijection on 64 bits
+    x += 0x9e3779b97f4a7c15UL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return (long) (x ^ (x >> 31));
+}
+
+long bench_peak_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+int bench_threads() {
+    const char* e = getenv("BENCH_THREADS");
+    if (e != NULL && atoi(e) > 0) return atoi(e);
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+#define BENCH_LAT_SAMPLES (1UL << 20)
+
+void bench_lat_init(bench_lat* l, unsigned long expected) {
+    l->k = expected / BENCH_LAT_SAMPLES + 1;
+    l->z = expected / l->k + 1;
+    l->v = malloc(sizeof(unsigned long long) * l->z);
+    Assert(l->v != NULL, __func__, "malloc error");
+    l->n = 0;
+    l->i = 0;
+}
+
+void bench_lat_add(bench_lat* l, unsigned long long x) {
+    if (l->i++ % l->k != 0 || l->n == l->z) return;
+    l->v[l->n++] = x;
+}
+
+static int _cmp_ull(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*) a;
+    unsigned long long y = *(const unsigned long long*) b;
+    return (x > y) - (x < y);
+}
+
+unsigned long long bench_lat_pct(bench_lat* l, double q) {
+    if (l->n == 0) return 0;
+    qsort(l->v, l->n, sizeof(unsigned long long), _cmp_ull);
+    unsigned long i = (unsigned long) (q * (l->n - 1));
+    return l->v[i];
+}
+
+void bench_lat_free(bench_lat* l) {
+    free(l->v);
+}
+
+void bench_line_start(const char* bench, unsigned long n) {
+    printf("{\"bench\":\"%s\",\"build\":\"%s\",\"n\":%lu", bench, BENCH_BUILD, n);
+}
+
+void bench_line_end() {
+    printf(",\"peak_rss_kb\":%ld}\n", bench_peak_rss_kb());
+    fflush(stdout);
+}
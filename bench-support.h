@@ -0,0 +1,90 @@
+#include <stdio.h>
+
+#ifndef TREE_BENCH_SUPPORT_H
+#define TREE_BENCH_SUPPORT_H
+
+#ifdef TREE_RELEASE
+#define BENCH_BUILD "release"
+#else
+#define BENCH_BUILD "debug"
+#endif
+
+/*
+    timestamps: cycles (rdtsc where there is one) for
+    microbenchmarks, wall clock nanoseconds otherwise
+*/
+unsigned long long bench_cycles();
+unsigned long long bench_ns();
+
+/*
+    xorshift, so that key generation is cheap and repeatable
+*/
+void bench_seed(unsigned long long s);
+long bench_rand();
+
+/*
+    cnt random keys, caller frees
+*/
+long* bench_random_nums(unsigned long cnt);
+
+/*
+    shuffle nums in place
+*/
+void bench_shuffle(long* nums, unsigned long cnt);
+
+/*
+    zipfian ranks in [0, n) with skew theta (ycsb style), hot
+    ranks are scattered over the key space by bench_scatter
+*/
+typedef struct zipf zipf;
+struct zipf {
+    unsigned long n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+};
+void zipf_init(zipf* z, unsigned long n, double theta);
+unsigned long zipf_next(zipf* z);
+long bench_scatter(unsigned long x);
+
+/*
+    peak resident set size of this process, in KiB
+*/
+long bench_peak_rss_kb();
+
+/*
+    the most threads to run the multi-threaded benches with:
+    $BENCH_THREADS if set, otherwise the number of cpus online
+*/
+int bench_threads();
+
+/*
+    latency samples, keeping at most a fixed number by taking
+    every k-th sample once the expected count is known
+*/
+typedef struct bench_lat bench_lat;
+struct bench_lat {
+    unsigned long long* v;
+    unsigned long n; // samples kept
+    unsigned long z; // capacity
+    unsigned long k; // keep every k-th
+    unsigned long i; // samples offered
+};
+void bench_lat_init(bench_lat* l, unsigned long expected);
+void bench_lat_add(bench_lat* l, unsigned long long x);
+// sorts the samples, q in [0, 1]
+unsigned long long bench_lat_pct(bench_lat* l, double q);
+void bench_lat_free(bench_lat* l);
+
+/*
+    results are one json object per line:
+
+        {"bench":"...","build":"...","n":...,<fields>,"peak_rss_kb":...}
+
+    so runs from two commits can be diffed or joined on bench/n
+*/
+void bench_line_start(const char* bench, unsigned long n);
+void bench_line_end();
+
+#endif //TREE_BENCH_SUPPORT_H
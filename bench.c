@@ -0,0 +1,1306 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "../queue/queue.h"
+#include "../tree-node/tree_node.h"
+
+#include "bench-support.h"
+#include "bench-internal.h"
+#include "tree.h"
+#include "frozen.h"
+#include "btree.h"
+#include "compact.h"
+#include "pathtree.h"
+#include "rcu.h"
+#include "cow.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "wal.h"
+
+/*
+    benchmarks.  build with `make bench` and run as
+
+        ./bench [suite|micro] [count ...]
+
+    the suite runs each key distribution and op mix as its own
+    process (so peak rss is per workload) and the micro benches
+    compare implementation choices head to head.  with no counts
+    the sizes are 1K through 100M keys.  output is json lines,
+    see bench-support.h.  `make release` builds the same thing as
+    ./bench-release with logging and asserts compiled out
+*/
+
+/*
+    the insert path as it was before tree_insert learned to
+    find a duplicate and the attach point in one walk: a full
+    tree_search, then _insert_node walks the same path again
+*/
+static void _insert_two_pass(tree* t, long d) {
+    tree_node* n = _get_root(t);
+    tree_node* x;
+    if (n == NULL) {
+        t->r = tree_node_new(d);
+        t->s += 1;
+        return;
+    }
+    x = tree_search(t, d);
+    if (x) {
+        x->c += 1;
+        return;
+    }
+    n = _insert_node(n, tree_node_new(d));
+    if (n->p == NULL) t->r = n;
+    t->s += 1;
+}
+
+static double _insert_run(long* nums, unsigned long cnt, void (*insert)(tree*, long)) {
+    tree* t = tree_new();
+    unsigned long long start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        insert(t, nums[i]);
+    }
+    double cycles = (double) (bench_cycles() - start) / cnt;
+    _tree_free(t);
+    return cycles;
+}
+
+static void bench_insert(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    // warm up, so both runs see the same recycled heap
+    _insert_run(nums, cnt, tree_insert);
+    double two = _insert_run(nums, cnt, _insert_two_pass);
+    double one = _insert_run(nums, cnt, tree_insert);
+    bench_line_start("insert", cnt);
+    printf(",\"two_pass_cycles\":%.1f,\"one_pass_cycles\":%.1f", two, one);
+    bench_line_end();
+    free(nums);
+}
+
+/*
+    the recursive search tree.c used before it went to a loop
+*/
+static tree_node* _search_recursive(tree_node* n, long d) {
+    if (n->d == d) return n;
+    if (d < n->d && n->l != NULL) return _search_recursive(n->l, d);
+    if (d > n->d && n->r != NULL) return _search_recursive(n->r, d);
+    return NULL;
+}
+
+static tree_node* _search_recursive_tree(tree* t, long d) {
+    tree_node* n = _get_root(t);
+    if (n == NULL) return NULL;
+    return _search_recursive(n, d);
+}
+
+/*
+    time each of cnt lookups on its own, cycles into l
+*/
+static void _lookup_run(tree* t, long* nums, unsigned long cnt, tree_node* (*search)(tree*, long), bench_lat* l) {
+    unsigned long found = 0;
+    bench_lat_init(l, cnt);
+    for (unsigned long i = 0; i < cnt; i++) {
+        unsigned long long start = bench_cycles();
+        if (search(t, nums[i]) != NULL) found++;
+        bench_lat_add(l, bench_cycles() - start);
+    }
+    Assert(found == cnt, __func__, "lookups missed: %lu of %lu", cnt - found, cnt);
+}
+
+static void bench_lookup(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    tree* t = tree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, nums[i]);
+    }
+    // look the keys up in a different order than inserted
+    bench_shuffle(nums, cnt);
+    bench_lat r, i;
+    _lookup_run(t, nums, cnt, _search_recursive_tree, &r);
+    _lookup_run(t, nums, cnt, tree_search, &i);
+    bench_line_start("lookup", cnt);
+    printf(",\"recursive_p50_cycles\":%llu,\"recursive_p99_cycles\":%llu", bench_lat_pct(&r, 0.5), bench_lat_pct(&r, 0.99));
+    printf(",\"iterative_p50_cycles\":%llu,\"iterative_p99_cycles\":%llu", bench_lat_pct(&i, 0.5), bench_lat_pct(&i, 0.99));
+    bench_line_end();
+    bench_lat_free(&r);
+    bench_lat_free(&i);
+    _tree_free(t);
+    free(nums);
+}
+
+/*
+    malloc per node against the tree owned slab: build
+    time and teardown time through _tree_free
+*/
+static void bench_alloc(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    unsigned f[] = {0, TREE_SLAB};
+    for (int i = 0; i < 2; i++) {
+        tree* t = tree_new_flags(f[i]);
+        unsigned long long start = bench_cycles();
+        for (unsigned long j = 0; j < cnt; j++) {
+            tree_insert(t, nums[j]);
+        }
+        double build = (double) (bench_cycles() - start) / cnt;
+        start = bench_cycles();
+        _tree_free(t);
+        double teardown = (double) (bench_cycles() - start) / cnt;
+        bench_line_start("alloc", cnt);
+        printf(",\"alloc\":\"%s\",\"build_cycles\":%.1f,\"teardown_cycles\":%.1f", f[i] ? "slab" : "malloc", build, teardown);
+        bench_line_end();
+    }
+    free(nums);
+}
+
+/*
+    cache resident churn on a small tree, where the cost of
+    logging and asserts isn't hidden behind cache misses.
+    compare ./bench against ./bench-release
+*/
+static void bench_churn(unsigned long cnt) {
+    unsigned long z = 1024;
+    long* nums = bench_random_nums(z);
+    tree* t = tree_new();
+    for (unsigned long i = 0; i < z; i++) {
+        tree_insert(t, nums[i]);
+    }
+    unsigned long long start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        long d = nums[i % z];
+        tree_remove(t, d);
+        tree_insert(t, d);
+        tree_search(t, d);
+    }
+    double cycles = (double) (bench_cycles() - start) / (cnt * 3);
+    bench_line_start("churn", cnt);
+    printf(",\"tree\":%lu,\"cycles\":%.1f", z, cycles);
+    bench_line_end();
+    _tree_free(t);
+    free(nums);
+}
+
+static int _cmp_long(const void* a, const void* b) {
+    long x = *(const long*) a;
+    long y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+    tree_build_sorted against an insert loop over the same
+    (sorted) keys
+*/
+static void bench_build(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    qsort(nums, cnt, sizeof(long), _cmp_long);
+    unsigned long long start = bench_cycles();
+    tree* t = tree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, nums[i]);
+    }
+    double loop = (double) (bench_cycles() - start) / cnt;
+    _tree_free(t);
+    start = bench_cycles();
+    t = tree_build_sorted(nums, NULL, cnt);
+    double build = (double) (bench_cycles() - start) / cnt;
+    _tree_free(t);
+    bench_line_start("build_sorted", cnt);
+    printf(",\"insert_loop_cycles\":%.1f,\"build_sorted_cycles\":%.1f", loop, build);
+    bench_line_end();
+    free(nums);
+}
+
+/*
+    cold start from an unsorted dump: the tree_insert loop that
+    create_big_tree does, against tree_build from 1 thread up
+*/
+static void bench_bulk(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    unsigned long long start = bench_ns();
+    tree* t = tree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, nums[i]);
+    }
+    double loop = (double) (bench_ns() - start) / 1e6;
+    unsigned long s = tree_size(t);
+    _tree_free(t);
+    bench_line_start("bulk", cnt);
+    printf(",\"method\":\"insert_loop\",\"threads\":1,\"ms\":%.2f", loop);
+    bench_line_end();
+    int most = bench_threads();
+    for (int k = 1; k <= most; k = k * 2 > most && k < most ? most : k * 2) {
+        start = bench_ns();
+        t = tree_build(nums, cnt, 0, k);
+        double ms = (double) (bench_ns() - start) / 1e6;
+        Assert(tree_size(t) == s, __func__, "built %lu values, not %lu", tree_size(t), s);
+        _tree_free(t);
+        bench_line_start("bulk", cnt);
+        printf(",\"method\":\"tree_build\",\"threads\":%d,\"ms\":%.2f,\"speedup\":%.2f", k, ms, loop / ms);
+        bench_line_end();
+    }
+    free(nums);
+}
+
+/*
+    batches of 10K, 100K and 1M random updates against a tree of
+    cnt keys, through the batch api and through a loop of single
+    calls.  one insert batch then one remove batch of the same keys
+*/
+static void bench_batch(unsigned long cnt) {
+    long* base = bench_random_nums(cnt);
+    unsigned long sizes[] = {10000, 100000, 1000000};
+    for (int i = 0; i < sizeof(sizes) / sizeof(unsigned long); i++) {
+        unsigned long z = sizes[i];
+        long* b = bench_random_nums(z);
+        double cycles[2][2];
+        for (int batch = 0; batch < 2; batch++) {
+            tree* t = tree_new();
+            tree_insert_batch(t, base, cnt);
+            unsigned long long start = bench_cycles();
+            if (batch) {
+                tree_insert_batch(t, b, z);
+            } else {
+                for (unsigned long j = 0; j < z; j++) tree_insert(t, b[j]);
+            }
+            cycles[batch][0] = (double) (bench_cycles() - start) / z;
+            start = bench_cycles();
+            if (batch) {
+                tree_remove_batch(t, b, z);
+            } else {
+                for (unsigned long j = 0; j < z; j++) tree_remove(t, b[j]);
+            }
+            cycles[batch][1] = (double) (bench_cycles() - start) / z;
+            _tree_free(t);
+        }
+        bench_line_start("batch", cnt);
+        printf(",\"batch\":%lu,\"loop_insert_cycles\":%.1f,\"batch_insert_cycles\":%.1f", z, cycles[0][0], cycles[1][0]);
+        printf(",\"loop_remove_cycles\":%.1f,\"batch_remove_cycles\":%.1f", cycles[0][1], cycles[1][1]);
+        bench_line_end();
+        free(b);
+    }
+    free(base);
+}
+
+/*
+    full in-order walk and time to the first node, through the
+    tree_inorder queue and through a cursor
+*/
+static void bench_inorder(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    tree* t = tree_new();
+    tree_insert_batch(t, nums, cnt);
+    long sum = 0;
+    unsigned long long start = bench_cycles();
+    queue* q = tree_inorder(t);
+    tree_node* n = q_dequeue(q);
+    unsigned long long qfirst = bench_cycles() - start;
+    for (; n != NULL; n = q_dequeue(q)) {
+        sum += n->d;
+    }
+    free(q);
+    double qcycles = (double) (bench_cycles() - start) / cnt;
+    tree_cursor c;
+    start = bench_cycles();
+    n = tree_cursor_first(&c, t);
+    unsigned long long cfirst = bench_cycles() - start;
+    for (; n != NULL; n = tree_cursor_next(&c)) {
+        sum -= n->d;
+    }
+    double ccycles = (double) (bench_cycles() - start) / cnt;
+    Assert(sum == 0, __func__, "walks disagree");
+    bench_line_start("inorder", cnt);
+    printf(",\"queue_cycles\":%.1f,\"queue_first_cycles\":%llu", qcycles, qfirst);
+    printf(",\"cursor_cycles\":%.1f,\"cursor_first_cycles\":%llu", ccycles, cfirst);
+    bench_line_end();
+    _tree_free(t);
+    free(nums);
+}
+
+static bool _range_count(tree_node* n, void* arg) {
+    *(unsigned long*) arg += n->c;
+    return true;
+}
+
+/*
+    [x, x + span) range counts with tree_range against filtering
+    the whole tree_inorder queue, which is what it replaces.
+    keys are 0, 16, 32, ... so a span covers about span / 16 keys
+*/
+static void bench_range(unsigned long cnt) {
+    tree* t = tree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, (long) i * 16);
+    }
+    long span = 16 * 100;
+    int filtered = 10;
+    int ranged = 10000;
+    unsigned long a = 0;
+    unsigned long b = 0;
+    unsigned long long start = bench_cycles();
+    for (int i = 0; i < filtered; i++) {
+        long lo = (long) ((unsigned long) bench_rand() % (cnt * 16));
+        queue* q = tree_inorder(t);
+        for (tree_node* n = q_dequeue(q); n != NULL; n = q_dequeue(q)) {
+            if (n->d >= lo && n->d < lo + span) a += n->c;
+        }
+        free(q);
+    }
+    double fcycles = (double) (bench_cycles() - start) / filtered;
+    start = bench_cycles();
+    for (int i = 0; i < ranged; i++) {
+        long lo = (long) ((unsigned long) bench_rand() % (cnt * 16));
+        tree_range(t, lo, lo + span, _range_count, &b);
+    }
+    double rcycles = (double) (bench_cycles() - start) / ranged;
+    bench_line_start("range", cnt);
+    printf(",\"span_keys\":%ld,\"inorder_filter_cycles\":%.1f,\"tree_range_cycles\":%.1f,\"hits\":%lu", span / 16, fcycles, rcycles, a + b);
+    bench_line_end();
+    _tree_free(t);
+}
+
+/*
+    cost of keeping the aggregates on insert and remove, and
+    rank / select / count_range against a cursor walk
+*/
+static void bench_order(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    double ins[2], rem[2];
+    for (int a = 0; a < 2; a++) {
+        tree* t = tree_new_flags(a ? TREE_AUGMENTED : 0);
+        unsigned long long start = bench_cycles();
+        for (unsigned long i = 0; i < cnt; i++) {
+            tree_insert(t, nums[i]);
+        }
+        ins[a] = (double) (bench_cycles() - start) / cnt;
+        start = bench_cycles();
+        for (unsigned long i = 0; i < cnt; i += 2) {
+            tree_remove(t, nums[i]);
+        }
+        rem[a] = (double) (bench_cycles() - start) / ((cnt + 1) / 2);
+        _tree_free(t);
+    }
+    tree* t = tree_new_flags(TREE_AUGMENTED);
+    tree_insert_batch(t, nums, cnt);
+    int q = 1000;
+    unsigned long x = 0;
+    unsigned long long start = bench_cycles();
+    for (int i = 0; i < q; i++) {
+        x += tree_rank(t, nums[(unsigned long) bench_rand() % cnt]);
+    }
+    double rank = (double) (bench_cycles() - start) / q;
+    start = bench_cycles();
+    for (int i = 0; i < q; i++) {
+        x += tree_select(t, (unsigned long) bench_rand() % cnt)->c;
+    }
+    double sel = (double) (bench_cycles() - start) / q;
+    start = bench_cycles();
+    for (int i = 0; i < q; i++) {
+        long lo = nums[(unsigned long) bench_rand() % cnt];
+        x += tree_count_range(t, lo, lo + (1L << 50));
+    }
+    double range = (double) (bench_cycles() - start) / q;
+    // the walk it replaces, a few times since it's O(n)
+    int w = 5;
+    start = bench_cycles();
+    for (int i = 0; i < w; i++) {
+        long d = nums[(unsigned long) bench_rand() % cnt];
+        tree_cursor c;
+        for (tree_node* n = tree_cursor_first(&c, t); n != NULL && n->d < d; n = tree_cursor_next(&c)) {
+            x += n->c;
+        }
+    }
+    double walk = (double) (bench_cycles() - start) / w;
+    bench_line_start("order", cnt);
+    printf(",\"insert_cycles\":%.1f,\"aug_insert_cycles\":%.1f,\"remove_cycles\":%.1f,\"aug_remove_cycles\":%.1f", ins[0], ins[1], rem[0], rem[1]);
+    printf(",\"rank_cycles\":%.1f,\"select_cycles\":%.1f,\"count_range_cycles\":%.1f,\"walk_rank_cycles\":%.1f,\"x\":%lu", rank, sel, range, walk, x);
+    bench_line_end();
+    _tree_free(t);
+    free(nums);
+}
+
+/*
+    latency-sample style data (zipfian, lots of repeats): the
+    p50/p90/p99/p99.9 in one tree_quantiles call and one at a
+    time, against scanning the tree_inorder queue for them
+*/
+static void bench_quantile(unsigned long cnt) {
+    zipf z;
+    zipf_init(&z, cnt, 0.99);
+    tree* t = tree_new_flags(TREE_AUGMENTED);
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, (long) zipf_next(&z));
+    }
+    double qs[] = {0.5, 0.9, 0.99, 0.999};
+    int nq = sizeof(qs) / sizeof(double);
+    tree_node* out[4];
+    int reps = 1000;
+    unsigned long long start = bench_cycles();
+    for (int i = 0; i < reps; i++) {
+        tree_quantiles(t, qs, nq, out);
+    }
+    double many = (double) (bench_cycles() - start) / reps;
+    start = bench_cycles();
+    for (int i = 0; i < reps; i++) {
+        for (int j = 0; j < nq; j++) {
+            out[j] = tree_quantile(t, qs[j]);
+        }
+    }
+    double single = (double) (bench_cycles() - start) / reps;
+    start = bench_cycles();
+    unsigned long w = tree_rank(t, LONG_MAX);
+    queue* q = tree_inorder(t);
+    unsigned long seen = 0;
+    int j = 0;
+    for (tree_node* n = q_dequeue(q); n != NULL; n = q_dequeue(q)) {
+        seen += n->c;
+        while (j < nq && seen >= qs[j] * w) out[j++] = n;
+    }
+    free(q);
+    double scan = (double) (bench_cycles() - start);
+    bench_line_start("quantile", cnt);
+    printf(",\"distinct\":%lu,\"quantiles_cycles\":%.1f,\"quantile_x4_cycles\":%.1f,\"inorder_scan_cycles\":%.1f", tree_size(t), many, single, scan);
+    bench_line_end();
+    _tree_free(t);
+}
+
+/*
+    lookups in the pointer tree against its frozen snapshot,
+    for sizes in and well out of the llc
+*/
+static void bench_freeze(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    tree* t = tree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, nums[i]);
+    }
+    unsigned long long start = bench_cycles();
+    frozen* f = tree_freeze(t);
+    double freeze = (double) (bench_cycles() - start) / cnt;
+    bench_shuffle(nums, cnt);
+    // half hits, half (almost certainly) misses
+    for (unsigned long i = 0; i < cnt; i += 2) {
+        nums[i] = bench_rand();
+    }
+    unsigned long hits = 0;
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        hits += tree_search(t, nums[i]) != NULL;
+    }
+    double tree_cycles = (double) (bench_cycles() - start) / cnt;
+    unsigned long fhits = 0;
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        fhits += frozen_search(f, nums[i]) != 0;
+    }
+    double frozen_cycles = (double) (bench_cycles() - start) / cnt;
+    Assert(hits == fhits, __func__, "lookups disagree: %lu against %lu", hits, fhits);
+    unsigned long bounded = 0;
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        bounded += frozen_lower_bound(f, nums[i]) != 0;
+    }
+    double lower_bound_cycles = (double) (bench_cycles() - start) / cnt;
+    Assert(bounded >= hits, __func__, "lower bounds missed hits");
+    bench_line_start("freeze", cnt);
+    printf(",\"freeze_cycles\":%.1f,\"tree_search_cycles\":%.1f,\"frozen_search_cycles\":%.1f,\"frozen_lower_bound_cycles\":%.1f", freeze, tree_cycles, frozen_cycles, lower_bound_cycles);
+    bench_line_end();
+    frozen_free(f);
+    _tree_free(t);
+    free(nums);
+}
+
+/*
+    cut the tree at a random key and glue it back, over and over.
+    on augmented trees both grow with log n, where the insert loop
+    they replace grows with n.  plain trees also walk the smaller
+    half to recount its size
+*/
+/*
+    restart cost: reinserting every key against opening a saved
+    snapshot (mapped and checksummed, searchable in place) and
+    against opening and thawing it into a tree
+*/
+static void bench_snapshot(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    char path[] = "/tmp/bench-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    Assert(fd >= 0, __func__, "mkstemp");
+    close(fd);
+    unsigned long long start = bench_ns();
+    tree* t = tree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, nums[i]);
+    }
+    double insert = (double) (bench_ns() - start) / 1e6;
+    start = bench_ns();
+    Assert(tree_save(t, path), __func__, "saving to %s", path);
+    double save = (double) (bench_ns() - start) / 1e6;
+    start = bench_ns();
+    frozen* f = tree_open_mmap(path);
+    double open = (double) (bench_ns() - start) / 1e6;
+    Assert(f != NULL && f->n == tree_size(t), __func__, "opening %s", path);
+    start = bench_ns();
+    tree* u = frozen_thaw(f, 0);
+    double thaw = (double) (bench_ns() - start) / 1e6;
+    start = bench_ns();
+    frozen* v = tree_open_mmap_verified(path);
+    double verified = (double) (bench_ns() - start) / 1e6;
+    Assert(v != NULL, __func__, "verifying %s", path);
+    frozen_free(v);
+    bench_line_start("snapshot", cnt);
+    printf(",\"insert_ms\":%.2f,\"save_ms\":%.2f,\"open_mmap_ms\":%.2f,\"open_verified_ms\":%.2f,\"thaw_ms\":%.2f,\"bytes_per_key\":%.1f", insert, save, open, verified, thaw, (double) f->z / cnt);
+    bench_line_end();
+    frozen_free(f);
+    _tree_free(u);
+    _tree_free(t);
+    unlink(path);
+    free(nums);
+}
+
+/*
+    streaming a tree out and back in through memory, for keys
+    spread over all of 64 bits, dense keys, timestamps (gaps of
+    about a microsecond, in ns) and few keys with big counts.
+    slab trees, so each one's nodes are laid out in insert order
+    and not wherever the last one's were freed
+*/
+static void bench_stream(unsigned long cnt) {
+    const char* dists[] = {"random", "seq", "timestamps", "dup"};
+    for (int e = 0; e < 4; e++) {
+        tree* t = tree_new_flags(TREE_SLAB);
+        long ts = 1700000000000000000L;
+        for (unsigned long i = 0; i < cnt; i++) {
+            if (e == 0) tree_insert(t, bench_rand());
+            else if (e == 1) tree_insert(t, (long) i);
+            else if (e == 2) tree_insert(t, ts += (unsigned long) bench_rand() % 2000);
+            else tree_insert(t, (unsigned long) bench_rand() % (cnt / 16 + 1));
+        }
+        char* b;
+        size_t z;
+        FILE* o = open_memstream(&b, &z);
+        Assert(o != NULL, __func__, "open_memstream");
+        unsigned long long start = bench_ns();
+        Assert(tree_stream_write(t, o), __func__, "writing the stream");
+        fflush(o);
+        double write = (double) (bench_ns() - start) / 1e9;
+        fclose(o);
+        FILE* in = fmemopen(b, z, "r");
+        Assert(in != NULL, __func__, "fmemopen");
+        start = bench_ns();
+        tree* u = tree_stream_read(in, 0);
+        double read = (double) (bench_ns() - start) / 1e9;
+        fclose(in);
+        Assert(u != NULL && tree_size(u) == tree_size(t), __func__, "reading the stream back");
+        bench_line_start("stream", cnt);
+        printf(",\"dist\":\"%s\",\"bytes_per_key\":%.2f,\"write_mb_s\":%.1f,\"read_mb_s\":%.1f", dists[e], (double) z / tree_size(t), z / write / 1e6, z / read / 1e6);
+        bench_line_end();
+        _tree_free(u);
+        _tree_free(t);
+        free(b);
+    }
+}
+
+/*
+    update throughput with the log off and in each sync mode, and
+    how long replaying it takes.  the files go in a directory made
+    under the current one, so run it on the disk that matters (on
+    tmpfs an fsync costs nothing).  WAL_SYNC_ALWAYS fsyncs every
+    update, so it gets at most 10k of them
+*/
+static void bench_wal(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    const char* modes[] = {"off", "none", "group", "always"};
+    int sync[] = {0, WAL_SYNC_NONE, WAL_SYNC_GROUP, WAL_SYNC_ALWAYS};
+    char dir[] = "bench-wal-XXXXXX";
+    Assert(mkdtemp(dir) != NULL, __func__, "mkdtemp");
+    char path[64], snap[64], log[64];
+    snprintf(path, sizeof(path), "%s/t", dir);
+    snprintf(snap, sizeof(snap), "%s/t.snap", dir);
+    snprintf(log, sizeof(log), "%s/t.wal", dir);
+    for (int e = 0; e < 4; e++) {
+        unsigned long n = e == 3 && cnt > 10000 ? 10000 : cnt;
+        wal_options o = wal_defaults();
+        o.sync = sync[e];
+        o.checkpoint = 0;
+        tree* t = NULL;
+        wtree* w = NULL;
+        if (e == 0) t = tree_new();
+        else w = wtree_open(path, &o);
+        Assert(t != NULL || w != NULL, __func__, "opening the log");
+        // four inserts to a remove
+        unsigned long long start = bench_ns();
+        for (unsigned long i = 0; i < n; i++) {
+            if (e == 0) tree_insert(t, nums[i]);
+            else wtree_insert(w, nums[i]);
+            if (i % 4 == 3) {
+                if (e == 0) tree_remove(t, nums[i / 2]);
+                else wtree_remove(w, nums[i / 2]);
+            }
+        }
+        if (w != NULL) Assert(wtree_sync(w), __func__, "syncing the log");
+        double secs = (double) (bench_ns() - start) / 1e9;
+        bench_line_start("wal", n);
+        printf(",\"sync\":\"%s\",\"updates_per_s\":%.0f", modes[e], (n + n / 4) / secs);
+        if (w != NULL) {
+            unsigned long s = tree_size(wtree_tree(w));
+            Assert(wtree_close(w), __func__, "closing the log");
+            start = bench_ns();
+            w = wtree_open(path, &o);
+            double replay = (double) (bench_ns() - start) / 1e9;
+            Assert(w != NULL && tree_size(wtree_tree(w)) == s, __func__, "replaying the log");
+            printf(",\"replay_ms\":%.1f", replay * 1e3);
+            wtree_close(w);
+        } else {
+            _tree_free(t);
+        }
+        bench_line_end();
+        unlink(log);
+        unlink(snap);
+    }
+    rmdir(dir);
+    free(nums);
+}
+
+static void bench_split(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    unsigned f[] = {0, TREE_AUGMENTED};
+    for (int e = 0; e < 2; e++) {
+        tree* t = tree_new_flags(f[e]);
+        for (unsigned long i = 0; i < cnt; i++) {
+            tree_insert(t, nums[i]);
+        }
+        unsigned long s = tree_size(t);
+        int rounds = 1000;
+        unsigned long long split = 0;
+        unsigned long long concat = 0;
+        for (int i = 0; i < rounds; i++) {
+            tree* l;
+            tree* r;
+            unsigned long long start = bench_cycles();
+            tree_split(t, nums[bench_rand() % cnt], &l, &r);
+            split += bench_cycles() - start;
+            start = bench_cycles();
+            t = tree_concat(l, r);
+            concat += bench_cycles() - start;
+        }
+        Assert(tree_size(t) == s, __func__, "lost nodes: %lu of %lu", tree_size(t), s);
+        bench_line_start("split", cnt);
+        printf(",\"augmented\":%s,\"split_cycles\":%.0f,\"concat_cycles\":%.0f", e ? "true" : "false", (double) split / rounds, (double) concat / rounds);
+        bench_line_end();
+        _tree_free(t);
+    }
+    free(nums);
+}
+
+/*
+    merge two trees of cnt random values, half of them shared, by
+    each set operation from 1 thread up, against draining one tree
+    into the other with tree_insert
+*/
+static void _setop_trees(const long* nums, unsigned long cnt, tree** a, tree** b) {
+    *a = tree_new();
+    *b = tree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(*a, nums[i]);
+        tree_insert(*b, i % 2 == 0 ? nums[i] : nums[cnt + i]);
+    }
+}
+
+static void bench_setop(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt * 2);
+    int most = bench_threads();
+    const char* ops[] = {"insert", "union", "intersection", "difference"};
+    for (int e = 0; e < 4; e++) {
+        for (int k = 1; k <= most; k = k * 2 > most && k < most ? most : k * 2) {
+            tree* a;
+            tree* b;
+            _setop_trees(nums, cnt, &a, &b);
+            unsigned long long start = bench_ns();
+            if (e == 0) {
+                tree_cursor c;
+                for (tree_node* n = tree_cursor_first(&c, b); n != NULL; n = tree_cursor_next(&c)) {
+                    for (unsigned j = 0; j < n->c; j++) {
+                        tree_insert(a, n->d);
+                    }
+                }
+                _tree_free(b);
+            } else if (e == 1) a = tree_union(a, b, k);
+            else if (e == 2) a = tree_intersection(a, b, k);
+            else a = tree_difference(a, b, k);
+            double ms = (double) (bench_ns() - start) / 1e6;
+            bench_line_start("setop", cnt);
+            printf(",\"op\":\"%s\",\"threads\":%d,\"ms\":%.2f,\"size\":%lu", ops[e], k, ms, tree_size(a));
+            bench_line_end();
+            _tree_free(a);
+            if (e == 0) break;
+        }
+    }
+    free(nums);
+}
+
+static bool _btree_walk_sum(long d, unsigned c, void* arg) {
+    *(long*) arg += d;
+    return true;
+}
+
+/*
+    the avl tree against the b-tree, side by side: random
+    inserts, lookups, an in-order walk and removes
+*/
+static void bench_btree(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    tree* t = tree_new();
+    btree* b = btree_new();
+    double avl[4], wide[4];
+    unsigned long long start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, nums[i]);
+    }
+    avl[0] = (double) (bench_cycles() - start) / cnt;
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        btree_insert(b, nums[i]);
+    }
+    wide[0] = (double) (bench_cycles() - start) / cnt;
+    bench_shuffle(nums, cnt);
+    unsigned long found = 0;
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        found += tree_search(t, nums[i]) != NULL;
+    }
+    avl[1] = (double) (bench_cycles() - start) / cnt;
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        found -= btree_search(b, nums[i]) != 0;
+    }
+    wide[1] = (double) (bench_cycles() - start) / cnt;
+    Assert(found == 0, __func__, "lookups disagree");
+    long sum = 0;
+    tree_cursor c;
+    start = bench_cycles();
+    for (tree_node* n = tree_cursor_first(&c, t); n != NULL; n = tree_cursor_next(&c)) {
+        sum += n->d;
+    }
+    avl[2] = (double) (bench_cycles() - start) / cnt;
+    sum = -sum;
+    start = bench_cycles();
+    btree_inorder(b, _btree_walk_sum, &sum);
+    wide[2] = (double) (bench_cycles() - start) / cnt;
+    Assert(sum == 0, __func__, "walks disagree");
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_remove(t, nums[i]);
+    }
+    avl[3] = (double) (bench_cycles() - start) / cnt;
+    start = bench_cycles();
+    for (unsigned long i = 0; i < cnt; i++) {
+        btree_remove(b, nums[i]);
+    }
+    wide[3] = (double) (bench_cycles() - start) / cnt;
+    const char* names[] = {"avl", "btree"};
+    double* cycles[] = {avl, wide};
+    for (int i = 0; i < 2; i++) {
+        bench_line_start("btree", cnt);
+        printf(",\"engine\":\"%s\",\"insert_cycles\":%.1f,\"search_cycles\":%.1f,\"inorder_cycles\":%.1f,\"remove_cycles\":%.1f", names[i], cycles[i][0], cycles[i][1], cycles[i][2], cycles[i][3]);
+        bench_line_end();
+    }
+    _tree_free(t);
+    btree_free(b);
+    free(nums);
+}
+
+/*
+    bytes per key and lookup cycles: malloced nodes, slab nodes
+    and the compact index tree.  malloc bytes are glibc's chunk
+    size: the node plus an 8 byte header, rounded up to 16
+*/
+static void bench_compact(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    long* probe = malloc(cnt * sizeof(long));
+    for (unsigned long i = 0; i < cnt; i++) {
+        probe[i] = nums[i];
+    }
+    bench_shuffle(probe, cnt);
+    unsigned f[] = {0, TREE_SLAB};
+    for (int i = 0; i < 2; i++) {
+        tree* t = tree_new_flags(f[i]);
+        for (unsigned long j = 0; j < cnt; j++) {
+            tree_insert(t, nums[j]);
+        }
+        unsigned long found = 0;
+        unsigned long long start = bench_cycles();
+        for (unsigned long j = 0; j < cnt; j++) {
+            found += tree_search(t, probe[j]) != NULL;
+        }
+        double cycles = (double) (bench_cycles() - start) / cnt;
+        Assert(found == cnt, __func__, "lookups missed");
+        double bytes = f[i] ? (double) sizeof(tree_node) : (double) ((sizeof(tree_node) + 8 + 15) & ~15UL);
+        bench_line_start("compact", cnt);
+        printf(",\"layout\":\"%s\",\"bytes_per_key\":%.1f,\"lookup_cycles\":%.1f", f[i] ? "slab" : "malloc", bytes, cycles);
+        bench_line_end();
+        _tree_free(t);
+    }
+    ctree* c = ctree_new();
+    for (unsigned long j = 0; j < cnt; j++) {
+        ctree_insert(c, nums[j]);
+    }
+    unsigned long found = 0;
+    unsigned long long start = bench_cycles();
+    for (unsigned long j = 0; j < cnt; j++) {
+        found += ctree_search(c, probe[j]) != 0;
+    }
+    double cycles = (double) (bench_cycles() - start) / cnt;
+    Assert(found == cnt, __func__, "lookups missed");
+    bench_line_start("compact", cnt);
+    printf(",\"layout\":\"compact\",\"bytes_per_key\":%.1f,\"reserved_bytes_per_key\":%.1f,\"lookup_cycles\":%.1f", (double) sizeof(ctree_node), (double) c->z * sizeof(ctree_node) / ctree_size(c), cycles);
+    bench_line_end();
+    ctree_free(c);
+    free(probe);
+    free(nums);
+}
+
+/*
+    the parent pointer tree (slab allocated, to compare like with
+    like) against the parent free one: node bytes and the update
+    throughput of a random insert/remove churn at size cnt
+*/
+static void bench_pathtree(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt * 2);
+    tree* t = tree_new_flags(TREE_SLAB);
+    ptree* p = ptree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_insert(t, nums[i]);
+        ptree_insert(p, nums[i]);
+    }
+    // replace the first half with the second, one key at a time
+    unsigned long long start = bench_ns();
+    for (unsigned long i = 0; i < cnt; i++) {
+        tree_remove(t, nums[i]);
+        tree_insert(t, nums[cnt + i]);
+    }
+    double parent = (double) (bench_ns() - start);
+    start = bench_ns();
+    for (unsigned long i = 0; i < cnt; i++) {
+        ptree_remove(p, nums[i]);
+        ptree_insert(p, nums[cnt + i]);
+    }
+    double path = (double) (bench_ns() - start);
+    Assert(tree_size(t) == ptree_size(p), __func__, "trees disagree");
+    bench_line_start("pathtree", cnt);
+    printf(",\"parent_node_bytes\":%lu,\"path_node_bytes\":%lu", (unsigned long) sizeof(tree_node), (unsigned long) sizeof(ptree_node));
+    printf(",\"parent_updates_per_sec\":%.0f,\"path_updates_per_sec\":%.0f", cnt * 2e9 / parent, cnt * 2e9 / path);
+    bench_line_end();
+    _tree_free(t);
+    ptree_free(p);
+    free(nums);
+}
+
+/*
+    read scaling: k threads each doing searches with a w% write
+    mix for a fixed time, against the rcu tree (lock free reads,
+    writers take turns) and a plain tree behind one mutex
+*/
+#define BENCH_RCU_NS 200000000ULL
+
+typedef struct rcu_worker rcu_worker;
+struct rcu_worker {
+    rtree* r; // the rcu tree, or
+    tree* t; // the plain tree and its lock
+    pthread_mutex_t* m;
+    const long* nums;
+    unsigned long cnt;
+    int w; // write percentage
+    unsigned long long seed;
+    unsigned long long end;
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long hits; // searches that found their key
+};
+
+static void* _rcu_work(void* arg) {
+    rcu_worker* a = arg;
+    rtree_reader* reader = a->r != NULL ? rtree_reader_new(a->r) : NULL;
+    unsigned long long x = a->seed;
+    unsigned long found = 0;
+    while (true) {
+        for (int i = 0; i < 1024; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            long d = a->nums[x % a->cnt];
+            bool write = (int) ((x >> 40) % 100) < a->w;
+            if (a->r != NULL) {
+                if (!write) {
+                    rtree_read_lock(reader);
+                    found += rtree_search(a->r, d) > 0;
+                    rtree_read_unlock(reader);
+                } else if (x & (1ULL << 32)) rtree_insert(a->r, d);
+                else rtree_remove(a->r, d);
+            } else {
+                pthread_mutex_lock(a->m);
+                if (!write) found += tree_search(a->t, d) != NULL;
+                else if (x & (1ULL << 32)) tree_insert(a->t, d);
+                else tree_remove(a->t, d);
+                pthread_mutex_unlock(a->m);
+            }
+            if (write) a->writes++;
+            else a->reads++;
+        }
+        if (bench_ns() > a->end) break;
+    }
+    a->hits = found;
+    return NULL;
+}
+
+static void bench_rcu(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    int most = bench_threads();
+    int mixes[] = {1, 10};
+    for (int e = 0; e < 2; e++) {
+        for (int m = 0; m < 2; m++) {
+            for (int k = 1; k <= most; k = k * 2 > most && k < most ? most : k * 2) {
+                rtree* r = NULL;
+                tree* t = NULL;
+                pthread_mutex_t lock;
+                if (e == 0) {
+                    r = rtree_new(k);
+                    for (unsigned long i = 0; i < cnt; i++) {
+                        rtree_insert(r, nums[i]);
+                    }
+                } else {
+                    t = tree_new();
+                    pthread_mutex_init(&lock, NULL);
+                    for (unsigned long i = 0; i < cnt; i++) {
+                        tree_insert(t, nums[i]);
+                    }
+                }
+                pthread_t th[k];
+                rcu_worker w[k];
+                unsigned long long start = bench_ns();
+                for (int i = 0; i < k; i++) {
+                    w[i] = (rcu_worker) {r, t, &lock, nums, cnt, mixes[m], 0x9e3779b97f4a7c15ULL * (i + 1), start + BENCH_RCU_NS, 0, 0, 0};
+                    Assert(pthread_create(&th[i], NULL, _rcu_work, &w[i]) == 0, __func__, "pthread_create");
+                }
+                unsigned long reads = 0;
+                unsigned long writes = 0;
+                for (int i = 0; i < k; i++) {
+                    pthread_join(th[i], NULL);
+                    reads += w[i].reads;
+                    writes += w[i].writes;
+                }
+                double secs = (double) (bench_ns() - start) / 1e9;
+                bench_line_start("rcu", cnt);
+                printf(",\"tree\":\"%s\",\"threads\":%d,\"write_pct\":%d", e == 0 ? "rcu" : "mutex", k, mixes[m]);
+                printf(",\"reads_per_sec\":%.0f,\"writes_per_sec\":%.0f", reads / secs, writes / secs);
+                bench_line_end();
+                if (e == 0) rtree_free(r);
+                else {
+                    _tree_free(t);
+                    pthread_mutex_destroy(&lock);
+                }
+            }
+        }
+    }
+    free(nums);
+}
+
+static vtree_node* _cow_copy(vtree_node* n) {
+    if (n == NULL) return NULL;
+    vtree_node* x = malloc(sizeof(vtree_node));
+    Assert(x != NULL, __func__, "malloc error");
+    x->l = _cow_copy(n->l);
+    x->r = _cow_copy(n->r);
+    x->d = n->d;
+    x->c = n->c;
+    atomic_init(&x->k, 1);
+    x->b = n->b;
+    return x;
+}
+
+static void _cow_copy_free(vtree_node* n) {
+    if (n == NULL) return;
+    _cow_copy_free(n->l);
+    _cow_copy_free(n->r);
+    free(n);
+}
+
+/*
+    what snapshots cost a writer.  random updates (an insert and a
+    remove each) with no snapshot out, then with one held and
+    swapped for a new one every 1000 and every 10 updates, giving
+    the time per update and the most nodes the versions held past
+    the live ones.  against that, taking a full copy of the nodes,
+    which is the time and memory every snapshot would cost without
+    sharing
+*/
+static void bench_cow(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    vtree* t = vtree_new();
+    for (unsigned long i = 0; i < cnt; i++) {
+        vtree_insert(t, nums[i]);
+    }
+    unsigned long updates = cnt < 200000 ? cnt : 200000;
+    unsigned long every[] = {0, 1000, 10};
+    for (int e = 0; e < 3; e++) {
+        vview* v = NULL;
+        unsigned long extra = 0;
+        unsigned long snaps = 0;
+        unsigned long long snap = 0;
+        unsigned long long start = bench_ns();
+        for (unsigned long i = 0; i < updates; i++) {
+            if (every[e] > 0 && i % every[e] == 0) {
+                unsigned long x = atomic_load(&t->n) - t->s;
+                if (x > extra) extra = x;
+                unsigned long long s = bench_ns();
+                vview* u = vtree_snapshot(t);
+                snap += bench_ns() - s;
+                snaps++;
+                if (v != NULL) vview_release(v);
+                v = u;
+            }
+            // swap a key out for a new one, so the size holds
+            unsigned long k = (unsigned long) bench_rand() % cnt;
+            vtree_remove(t, nums[k]);
+            nums[k] = bench_rand();
+            vtree_insert(t, nums[k]);
+        }
+        double ns = (double) (bench_ns() - start - snap) / updates;
+        if (v != NULL) vview_release(v);
+        bench_line_start("cow", cnt);
+        printf(",\"snapshot\":\"cow\",\"every\":%lu,\"update_ns\":%.0f", every[e], ns);
+        printf(",\"snapshot_ns\":%.0f,\"extra_kb\":%.0f", snaps > 0 ? (double) snap / snaps : 0.0, (double) extra * sizeof(vtree_node) / 1024);
+        bench_line_end();
+    }
+    unsigned long long start = bench_ns();
+    vtree_node* c = _cow_copy(t->r);
+    double ns = (double) (bench_ns() - start);
+    bench_line_start("cow", cnt);
+    printf(",\"snapshot\":\"full_copy\",\"snapshot_ns\":%.0f,\"extra_kb\":%.0f", ns, (double) t->s * sizeof(vtree_node) / 1024);
+    bench_line_end();
+    _cow_copy_free(c);
+    vtree_free(t);
+    free(nums);
+}
+
+/*
+    write scaling: k threads each inserting and removing random
+    keys for a fixed time, against 64 hashed shards and against
+    a single shard, which is one tree behind one lock
+*/
+typedef struct stree_worker stree_worker;
+struct stree_worker {
+    stree* s;
+    const long* nums;
+    unsigned long cnt;
+    unsigned long long seed;
+    unsigned long long end;
+    unsigned long writes;
+};
+
+static void* _stree_work(void* arg) {
+    stree_worker* a = arg;
+    unsigned long long x = a->seed;
+    while (true) {
+        for (int i = 0; i < 1024; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            long d = a->nums[x % a->cnt];
+            if (x & (1ULL << 32)) stree_insert(a->s, d);
+            else stree_remove(a->s, d);
+        }
+        a->writes += 1024;
+        if (bench_ns() > a->end) break;
+    }
+    return NULL;
+}
+
+static void bench_stree(unsigned long cnt) {
+    long* nums = bench_random_nums(cnt);
+    int most = bench_threads();
+    size_t shards[] = {1, 64};
+    for (int e = 0; e < 2; e++) {
+        for (int k = 1; k <= most; k = k * 2 > most && k < most ? most : k * 2) {
+            stree* s = stree_new(shards[e]);
+            for (unsigned long i = 0; i < cnt; i++) {
+                stree_insert(s, nums[i]);
+            }
+            pthread_t th[k];
+            stree_worker w[k];
+            unsigned long long start = bench_ns();
+            for (int i = 0; i < k; i++) {
+                w[i] = (stree_worker) {s, nums, cnt, 0x9e3779b97f4a7c15ULL * (i + 1), start + BENCH_RCU_NS, 0};
+                Assert(pthread_create(&th[i], NULL, _stree_work, &w[i]) == 0, __func__, "pthread_create");
+            }
+            unsigned long writes = 0;
+            for (int i = 0; i < k; i++) {
+                pthread_join(th[i], NULL);
+                writes += w[i].writes;
+            }
+            double secs = (double) (bench_ns() - start) / 1e9;
+            bench_line_start("stree", cnt);
+            printf(",\"shards\":%zu,\"threads\":%d,\"writes_per_sec\":%.0f", shards[e], k, writes / secs);
+            bench_line_end();
+            stree_free(s);
+        }
+    }
+    free(nums);
+}
+
+static void bench_micro(unsigned long cnt) {
+    bench_insert(cnt);
+    bench_alloc(cnt);
+    bench_lookup(cnt);
+    bench_churn(cnt);
+    bench_build(cnt);
+    bench_bulk(cnt);
+    bench_batch(cnt);
+    bench_inorder(cnt);
+    bench_range(cnt);
+    bench_order(cnt);
+    bench_quantile(cnt);
+    bench_freeze(cnt);
+    bench_snapshot(cnt);
+    bench_stream(cnt);
+    bench_wal(cnt);
+    bench_split(cnt);
+    bench_setop(cnt);
+    bench_btree(cnt);
+    bench_compact(cnt);
+    bench_pathtree(cnt);
+    bench_rcu(cnt);
+    bench_cow(cnt);
+    bench_stree(cnt);
+}
+
+/*
+    the suite: key distributions crossed with op mixes
+*/
+enum { DIST_SEQ, DIST_RANDOM, DIST_ZIPF, DIST_DUP, DIST_COUNT };
+static const char* dist_names[] = {"seq", "random", "zipf", "dup"};
+
+typedef struct mix mix;
+struct mix {
+    const char* name;
+    int search; // percent of ops, the rest split between insert and remove
+    int insert;
+};
+static const mix mixes[] = {
+    {"load", 0, 100},
+    {"read_heavy", 90, 5},
+    {"write_heavy", 10, 45},
+};
+
+typedef struct keygen keygen;
+struct keygen {
+    int dist;
+    unsigned long n;
+    unsigned long i;
+    zipf z;
+};
+
+static long _next_key(keygen* g) {
+    switch (g->dist) {
+    case DIST_SEQ:
+        return (long) (g->i++ % g->n);
+    case DIST_RANDOM:
+        return bench_scatter((unsigned long) bench_rand() % g->n);
+    case DIST_ZIPF:
+        return bench_scatter(zipf_next(&g->z));
+    default: // DIST_DUP, n / 16 distinct keys
+        return bench_scatter((unsigned long) bench_rand() % (g->n / 16 + 1));
+    }
+}
+
+/*
+    load n keys of the distribution, then run n ops of the mix
+    (or just the load for the load mix), timing every op
+*/
+static void _suite_run(int dist, const mix* m, unsigned long n) {
+    keygen g = {dist, n, 0};
+    if (dist == DIST_ZIPF) zipf_init(&g.z, n, 0.99);
+    bench_seed(n);
+    tree* t = tree_new();
+    bench_lat l;
+    bench_lat_init(&l, n);
+    unsigned long long start = bench_ns();
+    bool load = m->search == 0 && m->insert == 100;
+    for (unsigned long i = 0; i < n; i++) {
+        long d = _next_key(&g);
+        unsigned long long s = load ? bench_ns() : 0;
+        tree_insert(t, d);
+        if (load) bench_lat_add(&l, bench_ns() - s);
+    }
+    if (!load) {
+        g.i = 0;
+        start = bench_ns();
+        for (unsigned long i = 0; i < n; i++) {
+            long d = _next_key(&g);
+            int op = (int) ((unsigned long) bench_rand() % 100);
+            unsigned long long s = bench_ns();
+            if (op < m->search) tree_search(t, d);
+            else if (op < m->search + m->insert) tree_insert(t, d);
+            else tree_remove(t, d);
+            bench_lat_add(&l, bench_ns() - s);
+        }
+    }
+    double secs = (double) (bench_ns() - start) / 1e9;
+    bench_line_start("suite", n);
+    printf(",\"dist\":\"%s\",\"mix\":\"%s\",\"ops_per_sec\":%.0f", dist_names[dist], m->name, n / secs);
+    printf(",\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu", bench_lat_pct(&l, 0.5), bench_lat_pct(&l, 0.9), bench_lat_pct(&l, 0.99), bench_lat_pct(&l, 0.999));
+    printf(",\"distinct\":%lu", tree_size(t));
+    bench_line_end();
+    bench_lat_free(&l);
+    _tree_free(t);
+}
+
+static void bench_suite(unsigned long n) {
+    for (int d = 0; d < DIST_COUNT; d++) {
+        for (int m = 0; m < sizeof(mixes) / sizeof(mix); m++) {
+            // one process per workload, so peak rss is its own
+            pid_t pid = fork();
+            Assert(pid >= 0, __func__, "fork error");
+            if (pid == 0) {
+                _suite_run(d, &mixes[m], n);
+                exit(0);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned long sizes[] = {1000, 10000, 100000, 1000000, 10000000, 100000000};
+    bool suite = true;
+    bool micro = true;
+    int i = 1;
+    if (argc > 1 && strcmp(argv[1], "suite") == 0) {
+        micro = false;
+        i++;
+    } else if (argc > 1 && strcmp(argv[1], "micro") == 0) {
+        suite = false;
+        i++;
+    }
+    unsigned long* counts = sizes;
+    int cnt = sizeof(sizes) / sizeof(unsigned long);
+    if (i < argc) {
+        counts = malloc(sizeof(unsigned long) * (argc - i));
+        Assert(counts != NULL, __func__, "malloc error");
+        for (cnt = 0; i < argc; i++) {
+            counts[cnt++] = strtoul(argv[i], NULL, 10);
+        }
+    }
+    for (i = 0; i < cnt; i++) {
+        if (suite) bench_suite(counts[i]);
+        if (micro) bench_micro(counts[i]);
+    }
+    if (counts != sizes) free(counts);
+    return 0;
+}
@@ -0,0 +1,401 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BTREE_X86 1
+#endif
+
+#include "../log/log.h"
+#include "release.h"
+
+#include "tree.h"
+#include "btree.h"
+
+#ifdef BTREE_X86
+// 1 when the cpu has avx2, set once by the first btree_new
+static int btree_avx2;
+static pthread_once_t btree_cpu_once = PTHREAD_ONCE_INIT;
+
+static void _btree_cpu() {
+    btree_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+/*
+    number of keys in x less than d, four at a time
+*/
+__attribute__((target("avx2")))
+static int _btree_rank_avx2(const btree_node* x, long d) {
+    __m256i v = _mm256_set1_epi64x(d);
+    __m256i r = _mm256_setzero_si256();
+    for (int i = 0; i < BTREE_KEYS + 1; i += 4) {
+        __m256i k = _mm256_load_si256((const __m256i*) (x->k + i));
+        // lanes where k < d are -1
+        r = _mm256_sub_epi64(r, _mm256_cmpgt_epi64(v, k));
+    }
+    __m128i h = _mm_add_epi64(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+    return (int) (_mm_cvtsi128_si64(h) + _mm_extract_epi64(h, 1));
+}
+#endif
+
+/*
+    number of keys in x less than d, which is where d is or goes.
+    the LONG_MAX padding is never less than d, so every slot can
+    be counted without looking at x->n
+*/
+static int _btree_rank(const btree_node* x, long d) {
+#ifdef BTREE_X86
+    if (btree_avx2) return _btree_rank_avx2(x, d);
+#endif
+    int r = 0;
+    for (int i = 0; i < BTREE_KEYS + 1; i++) {
+        r += x->k[i] < d;
+    }
+    return r;
+}
+
+/*
+    the children of x, which isn't a leaf
+*/
+static btree_node** _btree_ch(btree_node* x) {
+    Assert(!x->leaf, __func__, "a leaf has no children");
+    return ((btree_inner*) x)->ch;
+}
+
+/*
+    leaves stop short of the child pointers
+*/
+static btree_node* _btree_node_new(bool leaf) {
+    btree_node* x = aligned_alloc(64, leaf ? sizeof(btree_node) : sizeof(btree_inner));
+    Assert(x != NULL, __func__, "malloc error");
+    for (int i = 0; i < BTREE_KEYS + 1; i++) {
+        x->k[i] = LONG_MAX;
+    }
+    x->n = 0;
+    x->leaf = leaf;
+    return x;
+}
+
+btree* btree_new() {
+    btree* b = malloc(sizeof(btree));
+    Assert(b != NULL, __func__, "malloc error");
+    b->r = NULL;
+    b->s = 0;
+#ifdef BTREE_X86
+    pthread_once(&btree_cpu_once, _btree_cpu);
+#endif
+    return b;
+}
+
+/*
+    make room for a key at i (and a child at i + 1) in x
+*/
+static void _btree_open(btree_node* x, int i) {
+    memmove(x->k + i + 1, x->k + i, (x->n - i) * sizeof(long));
+    memmove(x->c + i + 1, x->c + i, (x->n - i) * sizeof(unsigned));
+    if (!x->leaf) memmove(_btree_ch(x) + i + 2, _btree_ch(x) + i + 1, (x->n - i) * sizeof(btree_node*));
+    x->n += 1;
+}
+
+/*
+    take the key at i (and the child at i + 1) out of x
+*/
+static void _btree_close(btree_node* x, int i) {
+    memmove(x->k + i, x->k + i + 1, (x->n - i - 1) * sizeof(long));
+    memmove(x->c + i, x->c + i + 1, (x->n - i - 1) * sizeof(unsigned));
+    if (!x->leaf) memmove(_btree_ch(x) + i + 1, _btree_ch(x) + i + 2, (x->n - i - 1) * sizeof(btree_node*));
+    x->n -= 1;
+    x->k[x->n] = LONG_MAX;
+}
+
+/*
+    split the full child i of x around its median, which moves
+    up into x
+*/
+static void _btree_split(btree_node* x, int i) {
+    btree_node* y = _btree_ch(x)[i];
+    btree_node* z = _btree_node_new(y->leaf);
+    memcpy(z->k, y->k + BTREE_T, (BTREE_T - 1) * sizeof(long));
+    memcpy(z->c, y->c + BTREE_T, (BTREE_T - 1) * sizeof(unsigned));
+    if (!y->leaf) memcpy(_btree_ch(z), _btree_ch(y) + BTREE_T, BTREE_T * sizeof(btree_node*));
+    z->n = BTREE_T - 1;
+    _btree_open(x, i);
+    x->k[i] = y->k[BTREE_T - 1];
+    x->c[i] = y->c[BTREE_T - 1];
+    _btree_ch(x)[i + 1] = z;
+    for (int j = BTREE_T - 1; j < BTREE_KEYS; j++) {
+        y->k[j] = LONG_MAX;
+    }
+    y->n = BTREE_T - 1;
+}
+
+/*
+    one pass down: full nodes are split on the way, so there is
+    always room for the median of a split below
+*/
+void btree_insert(btree* b, long d) {
+    if (b->r == NULL) b->r = _btree_node_new(true);
+    if (b->r->n == BTREE_KEYS) {
+        btree_node* s = _btree_node_new(false);
+        _btree_ch(s)[0] = b->r;
+        _btree_split(s, 0);
+        b->r = s;
+    }
+    btree_node* x = b->r;
+    for (;;) {
+        int i = _btree_rank(x, d);
+        if (i < x->n && x->k[i] == d) {
+            x->c[i] += 1;
+            return;
+        }
+        if (x->leaf) {
+            _btree_open(x, i);
+            x->k[i] = d;
+            x->c[i] = 1;
+            b->s += 1;
+            return;
+        }
+        if (_btree_ch(x)[i]->n == BTREE_KEYS) {
+            _btree_split(x, i);
+            if (x->k[i] == d) {
+                x->c[i] += 1;
+                return;
+            }
+            if (x->k[i] < d) i++;
+        }
+        x = _btree_ch(x)[i];
+    }
+}
+
+/*
+    the node and slot holding d, or NULL
+*/
+static btree_node* _btree_find(btree* b, long d, int* i) {
+    btree_node* x = b->r;
+    while (x != NULL) {
+        *i = _btree_rank(x, d);
+        if (*i < x->n && x->k[*i] == d) return x;
+        if (x->leaf) return NULL;
+        x = _btree_ch(x)[*i];
+    }
+    return NULL;
+}
+
+unsigned btree_search(btree* b, long d) {
+    int i;
+    btree_node* x = _btree_find(b, d, &i);
+    return x == NULL ? 0 : x->c[i];
+}
+
+/*
+    fold key i of x and child i + 1 into child i; both children
+    have BTREE_T - 1 keys
+*/
+static void _btree_merge(btree_node* x, int i) {
+    btree_node* y = _btree_ch(x)[i];
+    btree_node* z = _btree_ch(x)[i + 1];
+    y->k[BTREE_T - 1] = x->k[i];
+    y->c[BTREE_T - 1] = x->c[i];
+    memcpy(y->k + BTREE_T, z->k, z->n * sizeof(long));
+    memcpy(y->c + BTREE_T, z->c, z->n * sizeof(unsigned));
+    if (!y->leaf) memcpy(_btree_ch(y) + BTREE_T, _btree_ch(z), (z->n + 1) * sizeof(btree_node*));
+    y->n = BTREE_KEYS;
+    _btree_close(x, i);
+    free(z);
+}
+
+/*
+    move a key through x from child i - 1 into child i
+*/
+static void _btree_shift_right(btree_node* x, int i) {
+    btree_node* c = _btree_ch(x)[i];
+    btree_node* l = _btree_ch(x)[i - 1];
+    memmove(c->k + 1, c->k, c->n * sizeof(long));
+    memmove(c->c + 1, c->c, c->n * sizeof(unsigned));
+    if (!c->leaf) {
+        memmove(_btree_ch(c) + 1, _btree_ch(c), (c->n + 1) * sizeof(btree_node*));
+        _btree_ch(c)[0] = _btree_ch(l)[l->n];
+    }
+    c->k[0] = x->k[i - 1];
+    c->c[0] = x->c[i - 1];
+    c->n += 1;
+    x->k[i - 1] = l->k[l->n - 1];
+    x->c[i - 1] = l->c[l->n - 1];
+    l->n -= 1;
+    l->k[l->n] = LONG_MAX;
+}
+
+/*
+    move a key through x from child i + 1 into child i
+*/
+static void _btree_shift_left(btree_node* x, int i) {
+    btree_node* c = _btree_ch(x)[i];
+    btree_node* r = _btree_ch(x)[i + 1];
+    c->k[c->n] = x->k[i];
+    c->c[c->n] = x->c[i];
+    if (!c->leaf) _btree_ch(c)[c->n + 1] = _btree_ch(r)[0];
+    c->n += 1;
+    x->k[i] = r->k[0];
+    x->c[i] = r->c[0];
+    if (!r->leaf) memmove(_btree_ch(r), _btree_ch(r) + 1, r->n * sizeof(btree_node*));
+    // as _btree_close, whose child shuffle starts one over
+    memmove(r->k, r->k + 1, (r->n - 1) * sizeof(long));
+    memmove(r->c, r->c + 1, (r->n - 1) * sizeof(unsigned));
+    r->n -= 1;
+    r->k[r->n] = LONG_MAX;
+}
+
+/*
+    make sure child i of x has more than the minimum of keys
+    before descending into it.  returns the child to take, which
+    moves left when it was merged into its left sibling
+*/
+static int _btree_fill(btree_node* x, int i) {
+    if (_btree_ch(x)[i]->n >= BTREE_T) return i;
+    if (i > 0 && _btree_ch(x)[i - 1]->n >= BTREE_T) {
+        _btree_shift_right(x, i);
+    } else if (i < x->n && _btree_ch(x)[i + 1]->n >= BTREE_T) {
+        _btree_shift_left(x, i);
+    } else if (i < x->n) {
+        _btree_merge(x, i);
+    } else {
+        _btree_merge(x, i - 1);
+        i--;
+    }
+    return i;
+}
+
+/*
+    delete d, which is in the tree, in one pass down (clrs):
+    every node entered has a key to spare, so nothing has to be
+    fixed up on the way back
+*/
+static void _btree_delete(btree_node* x, long d) {
+    for (;;) {
+        int i = _btree_rank(x, d);
+        if (i < x->n && x->k[i] == d) {
+            if (x->leaf) {
+                _btree_close(x, i);
+                return;
+            }
+            btree_node* y = _btree_ch(x)[i];
+            btree_node* z = _btree_ch(x)[i + 1];
+            if (y->n >= BTREE_T) {
+                // replace d with its predecessor, and delete that
+                btree_node* p = y;
+                while (!p->leaf) p = _btree_ch(p)[p->n];
+                d = x->k[i] = p->k[p->n - 1];
+                x->c[i] = p->c[p->n - 1];
+                x = y;
+            } else if (z->n >= BTREE_T) {
+                btree_node* s = z;
+                while (!s->leaf) s = _btree_ch(s)[0];
+                d = x->k[i] = s->k[0];
+                x->c[i] = s->c[0];
+                x = z;
+            } else {
+                _btree_merge(x, i);
+                x = y;
+            }
+            continue;
+        }
+        Assert(!x->leaf, __func__, "%ld isn't in the tree", d);
+        x = _btree_ch(x)[_btree_fill(x, i)];
+    }
+}
+
+bool btree_remove(btree* b, long d) {
+    int i;
+    btree_node* x = _btree_find(b, d, &i);
+    if (x == NULL) return false;
+    if (x->c[i] > 1) {
+        x->c[i] -= 1;
+        return true;
+    }
+    _btree_delete(b->r, d);
+    b->s -= 1;
+    // a merge can empty the root
+    if (b->r->n == 0) {
+        btree_node* r = b->r;
+        b->r = r->leaf ? NULL : _btree_ch(r)[0];
+        free(r);
+    }
+    return true;
+}
+
+static bool _btree_walk(btree_node* x, bool (*f)(long d, unsigned c, void* arg), void* arg, unsigned long* k) {
+    for (int i = 0; i < x->n; i++) {
+        if (!x->leaf && !_btree_walk(_btree_ch(x)[i], f, arg, k)) return false;
+        *k += 1;
+        if (!f(x->k[i], x->c[i], arg)) return false;
+    }
+    return x->leaf || _btree_walk(_btree_ch(x)[x->n], f, arg, k);
+}
+
+unsigned long btree_inorder(btree* b, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    unsigned long k = 0;
+    if (b->r != NULL) _btree_walk(b->r, f, arg, &k);
+    return k;
+}
+
+unsigned long btree_size(btree* b) {
+    return b->s;
+}
+
+static void _btree_node_free(btree_node* x) {
+    if (!x->leaf) {
+        for (int i = 0; i <= x->n; i++) {
+            _btree_node_free(_btree_ch(x)[i]);
+        }
+    }
+    free(x);
+}
+
+void btree_free(btree* b) {
+    if (b->r != NULL) _btree_node_free(b->r);
+    free(b);
+}
+
+#ifdef _UNIT_TEST
+/*
+    check the b-tree invariants under x: keys ascending and above
+    *lo and below *hi (where there are bounds, NULL for none),
+    padding in place, key counts within bounds and every leaf at
+    the same depth.  returns the number of keys
+*/
+static unsigned long _btree_check_node(btree_node* x, const long* lo, const long* hi, int depth, int* leaf_depth) {
+    Assert(x->n <= BTREE_KEYS, __func__, "overfull node: %d keys", x->n);
+    for (int i = 0; i < x->n; i++) {
+        Assert(i == 0 ? lo == NULL || x->k[i] > *lo : x->k[i] > x->k[i - 1], __func__, "%ld out of order", x->k[i]);
+        Assert(hi == NULL || x->k[i] < *hi, __func__, "%ld out of order", x->k[i]);
+        Assert(x->c[i] > 0, __func__, "%ld has a zero count", x->k[i]);
+    }
+    for (int i = x->n; i < BTREE_KEYS + 1; i++) {
+        Assert(x->k[i] == LONG_MAX, __func__, "slot %d isn't padding", i);
+    }
+    if (x->leaf) {
+        if (*leaf_depth == -1) *leaf_depth = depth;
+        Assert(*leaf_depth == depth, __func__, "leaves at depths %d and %d", *leaf_depth, depth);
+        return x->n;
+    }
+    unsigned long s = x->n;
+    for (int i = 0; i <= x->n; i++) {
+        const long* l = i == 0 ? lo : x->k + i - 1;
+        const long* h = i == x->n ? hi : x->k + i;
+        // only the root may have fewer
+        Assert(_btree_ch(x)[i]->n >= BTREE_T - 1, __func__, "underfull node: %d keys", _btree_ch(x)[i]->n);
+        s += _btree_check_node(_btree_ch(x)[i], l, h, depth + 1, leaf_depth);
+    }
+    return s;
+}
+
+STATIC unsigned long _btree_check(btree* b) {
+    if (b->r == NULL) return 0;
+    int leaf_depth = -1;
+    unsigned long s = _btree_check_node(b->r, NULL, NULL, 0, &leaf_depth);
+    Assert(s == b->s, __func__, "%lu keys, size says %lu", s, b->s);
+    return s;
+}
+#endif
@@ -0,0 +1,77 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef TREE_BTREE_H
+#define TREE_BTREE_H
+
+/*
+    a b-tree of longs with counts, the wide-node counterpart of
+    the avl tree: up to BTREE_KEYS keys per node, so a lookup
+    touches a few cache lines in each of log_16(n) nodes instead
+    of one node per level.  the key slots past the last key hold
+    LONG_MAX, so a node is searched by counting the keys less
+    than the probe over every slot (avx2 where the cpu has it)
+*/
+#define BTREE_T 16 // minimum degree
+#define BTREE_KEYS (2 * BTREE_T - 1)
+
+/*
+    a leaf, and the start of every node
+*/
+typedef struct btree_node btree_node;
+struct btree_node {
+    _Alignas(64) long k[BTREE_KEYS + 1]; // keys, padded with LONG_MAX
+    unsigned c[BTREE_KEYS]; // counts
+    unsigned short n; // keys in use
+    bool leaf;
+};
+
+/*
+    an internal node, a leaf with children after it
+*/
+typedef struct btree_inner btree_inner;
+struct btree_inner {
+    btree_node x;
+    btree_node* ch[BTREE_KEYS + 1]; // children
+};
+
+typedef struct btree btree;
+struct btree {
+    btree_node* r; // root node
+    unsigned long s; // distinct keys, as tree->s
+};
+
+/*
+    create an empty b-tree
+*/
+btree* btree_new();
+
+/*
+    insert a data into a b-tree
+*/
+void btree_insert(btree* b, long d);
+
+/*
+    the count of d, 0 if it isn't in the b-tree
+*/
+unsigned btree_search(btree* b, long d);
+
+/*
+    remove one instance of d, true if there was one
+*/
+bool btree_remove(btree* b, long d);
+
+/*
+    call f on each key and its count, in order, until f returns
+    false.  returns the number of keys passed to f
+*/
+unsigned long btree_inorder(btree* b, bool (*f)(long d, unsigned c, void* arg), void* arg);
+
+/*
+    the number of distinct keys
+*/
+unsigned long btree_size(btree* b);
+
+void btree_free(btree* b);
+
+#endif //TREE_BTREE_H
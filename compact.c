@@ -0,0 +1,381 @@
+#include <stdlib.h>
+
+#include "../log/log.h"
+#include "release.h"
+
+#include "tree.h"
+#include "compact.h"
+
+#define CTREE_FIRST 1024
+
+/*
+    link and balance accessors, the top two bits of l hold b + 1
+*/
+static inline uint32_t _cl(ctree_node* v, uint32_t x) {
+    return v[x].l & CTREE_MAX;
+}
+
+static inline int _cb(ctree_node* v, uint32_t x) {
+    return (int) (v[x].l >> 30) - 1;
+}
+
+static inline void _set_l(ctree_node* v, uint32_t x, uint32_t y) {
+    v[x].l = (v[x].l & ~CTREE_MAX) | y;
+}
+
+static inline void _set_b(ctree_node* v, uint32_t x, int b) {
+    Assert(b > -2 && b < 2, __func__, "balance factor %d for %li", b, v[x].d);
+    v[x].l = (v[x].l & CTREE_MAX) | ((uint32_t) (b + 1) << 30);
+}
+
+ctree* ctree_new() {
+    ctree* t = malloc(sizeof(ctree));
+    Assert(t != NULL, __func__, "malloc error");
+    t->v = NULL;
+    t->r = CTREE_NIL;
+    t->f = CTREE_NIL;
+    t->n = 1;
+    t->z = 0;
+    t->m = CTREE_MAX;
+    t->s = 0;
+    return t;
+}
+
+/*
+    a fresh node, from the free list if there is one, CTREE_NIL if
+    the tree is full.  may move the array, so it comes before any
+    t->v is cached
+*/
+static uint32_t _ctree_node_new(ctree* t, long d) {
+    uint32_t x = t->f;
+    if (x != CTREE_NIL) {
+        t->f = t->v[x].r;
+    } else {
+        // past m an index would run into the balance bits
+        if (t->n > t->m) return CTREE_NIL;
+        if (t->n >= t->z) {
+            unsigned long z = t->z == 0 ? CTREE_FIRST : (unsigned long) t->z * 2;
+            if (z > (unsigned long) t->m + 1) z = (unsigned long) t->m + 1;
+            t->v = realloc(t->v, z * sizeof(ctree_node));
+            Assert(t->v != NULL, __func__, "malloc error");
+            t->z = z;
+        }
+        x = t->n++;
+    }
+    ctree_node* n = t->v + x;
+    n->d = d;
+    n->c = 1;
+    n->p = CTREE_NIL;
+    n->l = 1U << 30; // no child, b = 0
+    n->r = CTREE_NIL;
+    return x;
+}
+
+static void _ctree_node_free(ctree* t, uint32_t x) {
+    t->v[x].r = t->f;
+    t->f = x;
+}
+
+/*
+    the rotations, as in tree.c (see the pictures there), on
+    indexes.  X's balance factor is +-2, which doesn't fit in two
+    bits, so it is never stored; the callers pass it instead
+*/
+static uint32_t _ctree_right_right(ctree_node* v, uint32_t X) {
+    uint32_t Z = v[X].r;
+    int zb = _cb(v, Z);
+    Assert(zb != -1, __func__, "right left in right right case");
+    v[Z].p = v[X].p;
+    v[X].p = Z;
+    v[X].r = _cl(v, Z);
+    if (v[X].r != CTREE_NIL) v[v[X].r].p = X;
+    _set_l(v, Z, X);
+    _set_b(v, X, zb == 0 ? 1 : 0);
+    _set_b(v, Z, zb == 0 ? -1 : 0);
+    return Z;
+}
+
+static uint32_t _ctree_right_left(ctree_node* v, uint32_t X) {
+    uint32_t Z = v[X].r;
+    Assert(_cb(v, Z) == -1, __func__, "right right in right left case");
+    uint32_t Y = _cl(v, Z);
+    int yb = _cb(v, Y);
+    v[Y].p = v[X].p;
+    v[Z].p = Y;
+    v[X].p = Y;
+    v[X].r = _cl(v, Y);
+    if (v[X].r != CTREE_NIL) v[v[X].r].p = X;
+    _set_l(v, Z, v[Y].r);
+    if (v[Y].r != CTREE_NIL) v[v[Y].r].p = Z;
+    _set_l(v, Y, X);
+    v[Y].r = Z;
+    _set_b(v, X, yb == 1 ? -1 : 0);
+    _set_b(v, Z, yb == -1 ? 1 : 0);
+    _set_b(v, Y, 0);
+    return Y;
+}
+
+static uint32_t _ctree_left_left(ctree_node* v, uint32_t X) {
+    uint32_t Z = _cl(v, X);
+    int zb = _cb(v, Z);
+    Assert(zb != 1, __func__, "left right case in left left");
+    v[Z].p = v[X].p;
+    v[X].p = Z;
+    _set_l(v, X, v[Z].r);
+    if (v[Z].r != CTREE_NIL) v[v[Z].r].p = X;
+    v[Z].r = X;
+    _set_b(v, X, zb == 0 ? -1 : 0);
+    _set_b(v, Z, zb == 0 ? 1 : 0);
+    return Z;
+}
+
+static uint32_t _ctree_left_right(ctree_node* v, uint32_t X) {
+    uint32_t Z = _cl(v, X);
+    Assert(_cb(v, Z) == 1, __func__, "left left case in left right");
+    uint32_t Y = v[Z].r;
+    int yb = _cb(v, Y);
+    v[Y].p = v[X].p;
+    v[Z].p = Y;
+    v[X].p = Y;
+    _set_l(v, X, v[Y].r);
+    if (v[Y].r != CTREE_NIL) v[v[Y].r].p = X;
+    v[Z].r = _cl(v, Y);
+    if (v[Z].r != CTREE_NIL) v[v[Z].r].p = Z;
+    v[Y].r = X;
+    _set_l(v, Y, Z);
+    _set_b(v, X, yb == -1 ? 1 : 0);
+    _set_b(v, Z, yb == 1 ? -1 : 0);
+    _set_b(v, Y, 0);
+    return Y;
+}
+
+/*
+    rotate n, whose balance factor is b (+-2), and hang the new
+    top off of n's old parent, or make it the root
+*/
+static uint32_t _ctree_rebalance(ctree* t, uint32_t n, int b) {
+    ctree_node* v = t->v;
+    if (b == 2) {
+        if (_cb(v, v[n].r) >= 0) n = _ctree_right_right(v, n);
+        else n = _ctree_right_left(v, n);
+    } else {
+        if (_cb(v, _cl(v, n)) <= 0) n = _ctree_left_left(v, n);
+        else n = _ctree_left_right(v, n);
+    }
+    uint32_t p = v[n].p;
+    if (p == CTREE_NIL) t->r = n;
+    else if (v[p].d < v[n].d) v[p].r = n;
+    else _set_l(v, p, n);
+    return n;
+}
+
+/*
+    c was just attached, retrace up to where the height change is
+    absorbed.  a rotation puts an end to it, and is the only thing
+    that can change the root
+*/
+static void _ctree_retrace_insert(ctree* t, uint32_t c) {
+    ctree_node* v = t->v;
+    while (true) {
+        uint32_t p = v[c].p;
+        int b = _cb(v, p) + (_cl(v, p) == c ? -1 : 1);
+        if (b == 2 || b == -2) {
+            _ctree_rebalance(t, p, b);
+            return;
+        }
+        _set_b(v, p, b);
+        if (b == 0 || v[p].p == CTREE_NIL) return;
+        c = p;
+    }
+}
+
+/*
+    n just lost height under it and its balance factor is now b,
+    retrace as _retrace_remove does
+*/
+static void _ctree_retrace_remove(ctree* t, uint32_t n, int b) {
+    ctree_node* v = t->v;
+    while (true) {
+        if (b == 2 || b == -2) {
+            n = _ctree_rebalance(t, n, b);
+            b = _cb(v, n);
+        } else _set_b(v, n, b);
+        if (b != 0) return;
+        uint32_t p = v[n].p;
+        if (p == CTREE_NIL) return;
+        b = _cb(v, p) + (v[p].d < v[n].d ? -1 : 1);
+        n = p;
+    }
+}
+
+/*
+    replace node c with x under p, or at the root
+*/
+static void _ctree_splice(ctree* t, uint32_t p, uint32_t c, uint32_t x) {
+    ctree_node* v = t->v;
+    if (x != CTREE_NIL) v[x].p = p;
+    if (p == CTREE_NIL) t->r = x;
+    else if (_cl(v, p) == c) _set_l(v, p, x);
+    else v[p].r = x;
+}
+
+bool ctree_insert(ctree* t, long d) {
+    uint32_t n = t->r;
+    if (n == CTREE_NIL) {
+        t->r = _ctree_node_new(t, d);
+        if (t->r == CTREE_NIL) return false;
+        t->s += 1;
+        return true;
+    }
+    ctree_node* v = t->v;
+    while (true) {
+        uint32_t c;
+        if (d < v[n].d) c = _cl(v, n);
+        else if (d > v[n].d) c = v[n].r;
+        else {
+            v[n].c += 1;
+            return true;
+        }
+        if (c == CTREE_NIL) break;
+        n = c;
+    }
+    uint32_t x = _ctree_node_new(t, d);
+    if (x == CTREE_NIL) return false;
+    v = t->v;
+    if (d < v[n].d) _set_l(v, n, x);
+    else v[n].r = x;
+    v[x].p = n;
+    _ctree_retrace_insert(t, x);
+    t->s += 1;
+    return true;
+}
+
+static uint32_t _ctree_find(ctree* t, long d) {
+    ctree_node* v = t->v;
+    uint32_t n = t->r;
+    while (n != CTREE_NIL && v[n].d != d) {
+        n = d < v[n].d ? _cl(v, n) : v[n].r;
+    }
+    return n;
+}
+
+unsigned ctree_search(ctree* t, long d) {
+    uint32_t n = _ctree_find(t, d);
+    return n == CTREE_NIL ? 0 : t->v[n].c;
+}
+
+/*
+    unlink n, using the same cases as tree.c's _remove_*, and
+    retrace
+*/
+static void _ctree_unlink(ctree* t, uint32_t n) {
+    ctree_node* v = t->v;
+    uint32_t p = v[n].p;
+    uint32_t l = _cl(v, n);
+    uint32_t r = v[n].r;
+    if (l == CTREE_NIL && r == CTREE_NIL) {
+        _ctree_splice(t, p, n, CTREE_NIL);
+        if (p != CTREE_NIL) _ctree_retrace_remove(t, p, _cb(v, p) + (v[p].d < v[n].d ? -1 : 1));
+        return;
+    }
+    if (r == CTREE_NIL) {
+        // l is a leaf
+        _ctree_splice(t, p, n, l);
+        _ctree_retrace_remove(t, l, 0);
+        return;
+    }
+    if (_cl(v, r) == CTREE_NIL) {
+        _set_l(v, r, l);
+        if (l != CTREE_NIL) v[l].p = r;
+        _ctree_splice(t, p, n, r);
+        _ctree_retrace_remove(t, r, _cb(v, n) - 1);
+        return;
+    }
+    uint32_t c = r;
+    while (_cl(v, c) != CTREE_NIL) {
+        c = _cl(v, c);
+    }
+    uint32_t cp = v[c].p;
+    _set_l(v, cp, v[c].r);
+    if (v[c].r != CTREE_NIL) v[v[c].r].p = cp;
+    _set_b(v, c, _cb(v, n));
+    _ctree_splice(t, p, n, c);
+    _set_l(v, c, l);
+    v[l].p = c;
+    v[c].r = r;
+    v[r].p = c;
+    _ctree_retrace_remove(t, cp, _cb(v, cp) + 1);
+}
+
+bool ctree_remove(ctree* t, long d) {
+    uint32_t n = _ctree_find(t, d);
+    if (n == CTREE_NIL) return false;
+    if (t->v[n].c > 1) {
+        t->v[n].c -= 1;
+        return true;
+    }
+    _ctree_unlink(t, n);
+    _ctree_node_free(t, n);
+    t->s -= 1;
+    return true;
+}
+
+unsigned long ctree_inorder(ctree* t, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    ctree_node* v = t->v;
+    unsigned long k = 0;
+    uint32_t n = t->r;
+    if (n == CTREE_NIL) return 0;
+    while (_cl(v, n) != CTREE_NIL) n = _cl(v, n);
+    while (n != CTREE_NIL) {
+        k++;
+        if (!f(v[n].d, v[n].c, arg)) break;
+        // successor, by the parent links
+        if (v[n].r != CTREE_NIL) {
+            n = v[n].r;
+            while (_cl(v, n) != CTREE_NIL) n = _cl(v, n);
+        } else {
+            uint32_t c = n;
+            n = v[n].p;
+            while (n != CTREE_NIL && v[n].r == c) {
+                c = n;
+                n = v[n].p;
+            }
+        }
+    }
+    return k;
+}
+
+unsigned long ctree_size(ctree* t) {
+    return t->s;
+}
+
+void ctree_free(ctree* t) {
+    free(t->v);
+    free(t);
+}
+
+#ifdef _UNIT_TEST
+static int _ctree_check_node(ctree_node* v, uint32_t n, uint32_t p, unsigned long* s) {
+    if (n == CTREE_NIL) return 0;
+    *s += 1;
+    Assert(v[n].p == p, __func__, "bad parent for %li", v[n].d);
+    uint32_t l = _cl(v, n);
+    uint32_t r = v[n].r;
+    if (l != CTREE_NIL) Assert(v[l].d < v[n].d, __func__, "%li out of order", v[l].d);
+    if (r != CTREE_NIL) Assert(v[r].d > v[n].d, __func__, "%li out of order", v[r].d);
+    int hl = _ctree_check_node(v, l, n, s);
+    int hr = _ctree_check_node(v, r, n, s);
+    Assert(hr - hl == _cb(v, n), __func__, "balance factor %d for %li, heights %d %d", _cb(v, n), v[n].d, hl, hr);
+    return (hl > hr ? hl : hr) + 1;
+}
+
+/*
+    check parents, order and balance factors, return the height
+*/
+STATIC int _ctree_check(ctree* t) {
+    unsigned long s = 0;
+    int h = _ctree_check_node(t->v, t->r, CTREE_NIL, &s);
+    Assert(s == t->s, __func__, "%lu nodes, size says %lu", s, t->s);
+    return h;
+}
+#endif
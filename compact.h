@@ -0,0 +1,73 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TREE_COMPACT_H
+#define TREE_COMPACT_H
+
+/*
+    compact storage for very large trees.  nodes live in one
+    array and link to each other by 32-bit index instead of by
+    pointer, and the balance factor rides in the top two bits of
+    the left link, so a node is 24 bytes against 48 for a malloced
+    tree_node.  index 0 is never used, so 0 stands for "no node".
+    the array moves when it grows, so only indexes are stable
+*/
+#define CTREE_NIL 0
+#define CTREE_MAX ((1U << 30) - 1) // largest index, the link mask
+
+typedef struct ctree_node ctree_node;
+struct ctree_node {
+    long d; // data
+    unsigned c; // count
+    uint32_t p; // parent
+    uint32_t l; // left child, balance factor + 1 in the top bits
+    uint32_t r; // right child, the free list link when unused
+};
+
+typedef struct ctree ctree;
+struct ctree {
+    ctree_node* v; // the nodes
+    uint32_t r; // root
+    uint32_t f; // free list
+    uint32_t n; // slots handed out, counting v[0]
+    uint32_t z; // slots allocated
+    uint32_t m; // the largest index it may use, CTREE_MAX unless a test lowers it
+    unsigned long s; // distinct keys, as tree->s
+};
+
+/*
+    create an empty compact tree
+*/
+ctree* ctree_new();
+
+/*
+    insert a data into a compact tree.  false, leaving the tree as
+    it was, if d is new and every index is taken
+*/
+bool ctree_insert(ctree* t, long d);
+
+/*
+    the count of d, 0 if it isn't in the tree
+*/
+unsigned ctree_search(ctree* t, long d);
+
+/*
+    remove one instance of d, true if there was one
+*/
+bool ctree_remove(ctree* t, long d);
+
+/*
+    call f on each key and its count, in order, until f returns
+    false.  returns the number of keys passed to f
+*/
+unsigned long ctree_inorder(ctree* t, bool (*f)(long d, unsigned c, void* arg), void* arg);
+
+/*
+    the number of distinct keys
+*/
+unsigned long ctree_size(ctree* t);
+
+void ctree_free(ctree* t);
+
+#endif //TREE_COMPACT_H
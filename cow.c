@@ -0,0 +1,315 @@
+#include <stdlib.h>
+
+#include "../log/log.h"
+#include "release.h"
+
+#include "tree.h"
+#include "cow.h"
+#include "rotate.h"
+
+vtree* vtree_new() {
+    vtree* t = malloc(sizeof(vtree));
+    Assert(t != NULL, __func__, "malloc error");
+    t->r = NULL;
+    t->s = 0;
+    pthread_mutex_init(&t->w, NULL);
+    atomic_init(&t->n, 0);
+    atomic_init(&t->v, 0);
+    return t;
+}
+
+static vtree_node* _vtree_node_new(vtree* t, long d) {
+    vtree_node* n = malloc(sizeof(vtree_node));
+    Assert(n != NULL, __func__, "malloc error");
+    n->l = NULL;
+    n->r = NULL;
+    n->d = d;
+    n->c = 1;
+    atomic_init(&n->k, 1);
+    n->b = 0;
+    atomic_fetch_add_explicit(&t->n, 1, memory_order_relaxed);
+    return n;
+}
+
+/*
+    drop a reference to n.  the last one frees it and drops its
+    links in turn, so a version goes down to the nodes it shares
+    and stops there
+*/
+static void _vtree_unref(vtree* t, vtree_node* n) {
+    while (n != NULL && atomic_fetch_sub_explicit(&n->k, 1, memory_order_acq_rel) == 1) {
+        vtree_node* l = n->l;
+        vtree_node* r = n->r;
+        free(n);
+        atomic_fetch_sub_explicit(&t->n, 1, memory_order_relaxed);
+        _vtree_unref(t, l);
+        n = r;
+    }
+}
+
+/*
+    writer side.  everything below runs under t->w, on nodes
+    reached from the live root through nodes the write owns
+*/
+
+/*
+    a version of n this write can change: n itself if the link
+    being followed is its only one, otherwise a copy that shares
+    n's children, the link moving from n to it
+*/
+static vtree_node* _vtree_own(vtree* t, vtree_node* n) {
+    if (atomic_load_explicit(&n->k, memory_order_acquire) == 1) return n;
+    vtree_node* x = malloc(sizeof(vtree_node));
+    Assert(x != NULL, __func__, "malloc error");
+    x->l = n->l;
+    x->r = n->r;
+    x->d = n->d;
+    x->c = n->c;
+    atomic_init(&x->k, 1);
+    x->b = n->b;
+    if (x->l != NULL) atomic_fetch_add_explicit(&x->l->k, 1, memory_order_relaxed);
+    if (x->r != NULL) atomic_fetch_add_explicit(&x->r->k, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->n, 1, memory_order_relaxed);
+    _vtree_unref(t, n);
+    return x;
+}
+
+/*
+    n (owned) leaves the tree, its parent taking over the link to
+    its child
+*/
+static void _vtree_drop(vtree* t, vtree_node* n) {
+    Assert(atomic_load(&n->k) == 1, __func__, "dropping a shared node, %li", n->d);
+    free(n);
+    atomic_fetch_sub_explicit(&t->n, 1, memory_order_relaxed);
+}
+
+/*
+    the rotations only ever see nodes the write owns, and the
+    links they move keep their counts
+*/
+TREE_ROTATIONS(_vtree, vtree_node)
+
+/*
+    rotate X (owned, b = +-2), first taking ownership of the
+    nodes the rotation changes
+*/
+static vtree_node* _vtree_rebalance(vtree* t, vtree_node* X) {
+    if (X->b == 2) {
+        vtree_node* Z = X->r = _vtree_own(t, X->r);
+        if (Z->b >= 0) return _vtree_right_right(X);
+        Z->l = _vtree_own(t, Z->l);
+        return _vtree_right_left(X);
+    }
+    vtree_node* Z = X->l = _vtree_own(t, X->l);
+    if (Z->b <= 0) return _vtree_left_left(X);
+    Z->r = _vtree_own(t, Z->r);
+    return _vtree_left_right(X);
+}
+
+static vtree_node* _vtree_insert(vtree* t, vtree_node* n, long d, bool* grew) {
+    if (n == NULL) {
+        *grew = true;
+        t->s += 1;
+        return _vtree_node_new(t, d);
+    }
+    n = _vtree_own(t, n);
+    if (d == n->d) {
+        n->c += 1;
+        *grew = false;
+        return n;
+    }
+    if (d < n->d) {
+        n->l = _vtree_insert(t, n->l, d, grew);
+        if (*grew) n->b -= 1;
+    } else {
+        n->r = _vtree_insert(t, n->r, d, grew);
+        if (*grew) n->b += 1;
+    }
+    if (!*grew) return n;
+    if (n->b == 0) *grew = false;
+    else if (n->b == 2 || n->b == -2) {
+        n = _vtree_rebalance(t, n);
+        *grew = false;
+    }
+    return n;
+}
+
+/*
+    the side of n given by right just got shorter, rebalance and
+    say whether n's subtree did too
+*/
+static vtree_node* _vtree_shrunk(vtree* t, vtree_node* n, bool right, bool* shrunk) {
+    n->b += right ? -1 : 1;
+    if (n->b == 1 || n->b == -1) {
+        *shrunk = false;
+        return n;
+    }
+    if (n->b == 0) return n;
+    n = _vtree_rebalance(t, n);
+    *shrunk = n->b == 0;
+    return n;
+}
+
+static vtree_node* _vtree_remove_min(vtree* t, vtree_node* n, bool* shrunk) {
+    n = _vtree_own(t, n);
+    if (n->l == NULL) {
+        vtree_node* r = n->r;
+        _vtree_drop(t, n);
+        *shrunk = true;
+        return r;
+    }
+    n->l = _vtree_remove_min(t, n->l, shrunk);
+    return *shrunk ? _vtree_shrunk(t, n, false, shrunk) : n;
+}
+
+/*
+    remove one d, which is in the subtree under n
+*/
+static vtree_node* _vtree_remove(vtree* t, vtree_node* n, long d, bool* shrunk) {
+    n = _vtree_own(t, n);
+    if (d < n->d) {
+        n->l = _vtree_remove(t, n->l, d, shrunk);
+        return *shrunk ? _vtree_shrunk(t, n, false, shrunk) : n;
+    }
+    if (d > n->d) {
+        n->r = _vtree_remove(t, n->r, d, shrunk);
+        return *shrunk ? _vtree_shrunk(t, n, true, shrunk) : n;
+    }
+    if (n->c > 1) {
+        n->c -= 1;
+        *shrunk = false;
+        return n;
+    }
+    t->s -= 1;
+    if (n->l == NULL || n->r == NULL) {
+        vtree_node* c = n->l != NULL ? n->l : n->r;
+        _vtree_drop(t, n);
+        *shrunk = true;
+        return c;
+    }
+    // n takes over its successor, which comes out of the right
+    vtree_node* s = n->r;
+    while (s->l != NULL) s = s->l;
+    n->d = s->d;
+    n->c = s->c;
+    n->r = _vtree_remove_min(t, n->r, shrunk);
+    return *shrunk ? _vtree_shrunk(t, n, true, shrunk) : n;
+}
+
+static unsigned _vtree_count(vtree_node* n, long d) {
+    while (n != NULL && n->d != d) {
+        n = d < n->d ? n->l : n->r;
+    }
+    return n == NULL ? 0 : n->c;
+}
+
+void vtree_insert(vtree* t, long d) {
+    pthread_mutex_lock(&t->w);
+    bool grew;
+    t->r = _vtree_insert(t, t->r, d, &grew);
+    pthread_mutex_unlock(&t->w);
+}
+
+bool vtree_remove(vtree* t, long d) {
+    pthread_mutex_lock(&t->w);
+    // a miss copies nothing
+    bool found = _vtree_count(t->r, d) > 0;
+    if (found) {
+        bool shrunk;
+        t->r = _vtree_remove(t, t->r, d, &shrunk);
+    }
+    pthread_mutex_unlock(&t->w);
+    return found;
+}
+
+unsigned vtree_search(vtree* t, long d) {
+    pthread_mutex_lock(&t->w);
+    unsigned c = _vtree_count(t->r, d);
+    pthread_mutex_unlock(&t->w);
+    return c;
+}
+
+unsigned long vtree_size(vtree* t) {
+    pthread_mutex_lock(&t->w);
+    unsigned long s = t->s;
+    pthread_mutex_unlock(&t->w);
+    return s;
+}
+
+vview* vtree_snapshot(vtree* t) {
+    vview* v = malloc(sizeof(vview));
+    Assert(v != NULL, __func__, "malloc error");
+    v->t = t;
+    pthread_mutex_lock(&t->w);
+    v->r = t->r;
+    v->s = t->s;
+    if (v->r != NULL) atomic_fetch_add_explicit(&v->r->k, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&t->w);
+    atomic_fetch_add_explicit(&t->v, 1, memory_order_relaxed);
+    return v;
+}
+
+unsigned vview_search(vview* v, long d) {
+    return _vtree_count(v->r, d);
+}
+
+unsigned long vview_inorder(vview* v, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    vtree_node* stack[TREE_HEIGHT_MAX];
+    int h = 0;
+    unsigned long k = 0;
+    vtree_node* n = v->r;
+    while (n != NULL || h > 0) {
+        while (n != NULL) {
+            stack[h++] = n;
+            n = n->l;
+        }
+        n = stack[--h];
+        k++;
+        if (!f(n->d, n->c, arg)) break;
+        n = n->r;
+    }
+    return k;
+}
+
+unsigned long vview_size(vview* v) {
+    return v->s;
+}
+
+void vview_release(vview* v) {
+    _vtree_unref(v->t, v->r);
+    atomic_fetch_sub_explicit(&v->t->v, 1, memory_order_relaxed);
+    free(v);
+}
+
+void vtree_free(vtree* t) {
+    Assert(atomic_load(&t->v) == 0, __func__, "%lu views still out", atomic_load(&t->v));
+    _vtree_unref(t, t->r);
+    pthread_mutex_destroy(&t->w);
+    free(t);
+}
+
+#ifdef _UNIT_TEST
+static int _vtree_check_node(vtree_node* n, unsigned long* s) {
+    if (n == NULL) return 0;
+    *s += 1;
+    Assert(atomic_load(&n->k) > 0, __func__, "%li has no references", n->d);
+    if (n->l != NULL) Assert(n->l->d < n->d, __func__, "%li out of order", n->l->d);
+    if (n->r != NULL) Assert(n->r->d > n->d, __func__, "%li out of order", n->r->d);
+    int hl = _vtree_check_node(n->l, s);
+    int hr = _vtree_check_node(n->r, s);
+    Assert(hr - hl == n->b, __func__, "balance factor %d for %li, heights %d %d", n->b, n->d, hl, hr);
+    return (hl > hr ? hl : hr) + 1;
+}
+
+/*
+    check order, balance factors and references of the live
+    version, return the height.  no writer may be running
+*/
+STATIC int _vtree_check(vtree* t) {
+    unsigned long s = 0;
+    int h = _vtree_check_node(t->r, &s);
+    Assert(s == t->s, __func__, "%lu nodes, size says %lu", s, t->s);
+    return h;
+}
+#endif
@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef TREE_COW_H
+#define TREE_COW_H
+
+/*
+    a copy-on-write avl tree with O(1) snapshots.  nodes are
+    reference counted, one per link to them, and versions share
+    every node they have in common.  a snapshot is one more
+    reference to the root.  a writer copies a node only if it's
+    shared (and then only the nodes on its path, plus the ones a
+    rotation touches), and changes it in place otherwise, so with
+    no snapshots out an update costs what it does in pathtree.c.
+
+    a snapshot (vview) is immutable: any thread can scan or search
+    it without locks while writers go on, and releasing the last
+    reference to a version frees the nodes only it had.  updates,
+    snapshots and reads of the live tree take the writer lock
+*/
+typedef struct vtree_node vtree_node;
+struct vtree_node {
+    vtree_node* l; // left child
+    vtree_node* r; // right child
+    long d; // data
+    unsigned c; // count
+    _Atomic unsigned k; // references: links from parents, roots and views
+    short b; // balance factor
+};
+
+typedef struct vtree vtree;
+struct vtree {
+    vtree_node* r; // root node, the live version
+    unsigned long s; // distinct keys
+    pthread_mutex_t w; // held by writers
+    _Atomic unsigned long n; // nodes over all versions
+    _Atomic unsigned long v; // views not yet released
+};
+
+typedef struct vview vview;
+struct vview {
+    vtree* t;
+    vtree_node* r;
+    unsigned long s;
+};
+
+/*
+    create an empty tree
+*/
+vtree* vtree_new();
+
+/*
+    insert a data, or remove one instance of it (true if there
+    was one)
+*/
+void vtree_insert(vtree* t, long d);
+bool vtree_remove(vtree* t, long d);
+
+/*
+    the count of d in the live version, 0 if absent
+*/
+unsigned vtree_search(vtree* t, long d);
+
+/*
+    the number of distinct keys in the live version
+*/
+unsigned long vtree_size(vtree* t);
+
+/*
+    the live version as it is now, in O(1).  it doesn't change
+    until vview_release, whatever is written meanwhile
+*/
+vview* vtree_snapshot(vtree* t);
+
+/*
+    the count of d, 0 if absent
+*/
+unsigned vview_search(vview* v, long d);
+
+/*
+    call f on each key and its count, in order, until f returns
+    false.  returns the number of keys passed to f
+*/
+unsigned long vview_inorder(vview* v, bool (*f)(long d, unsigned c, void* arg), void* arg);
+
+/*
+    the number of distinct keys
+*/
+unsigned long vview_size(vview* v);
+
+/*
+    drop the view, freeing what no other version shares
+*/
+void vview_release(vview* v);
+
+/*
+    free the tree.  every view must have been released
+*/
+void vtree_free(vtree* t);
+
+#endif //TREE_COW_H
@@ -0,0 +1,140 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "../log/log.h"
+#include "release.h"
+#include "../tree-node/tree_node.h"
+
+#include "tree.h"
+#include "frozen.h"
+
+// slots per cache line, the prefetch looks this many levels down
+#define FROZEN_LINE (64 / sizeof(long))
+
+static void* _frozen_alloc(size_t z) {
+    // aligned_alloc wants a multiple of the alignment
+    void* p = aligned_alloc(64, (z + 63) & ~(size_t) 63);
+    Assert(p != NULL, __func__, "malloc error");
+    return p;
+}
+
+/*
+    fill the slots under i in order, so each slot gets the next
+    node of the in-order walk c
+*/
+static void _frozen_fill(frozen* f, size_t i, tree_cursor* c, unsigned long* w) {
+    if (i > f->n) return;
+    _frozen_fill(f, 2 * i, c, w);
+    f->k[i] = c->n->d;
+    f->c[i] = c->n->c;
+    f->w[i] = *w;
+    *w += c->n->c;
+    tree_cursor_next(c);
+    _frozen_fill(f, 2 * i + 1, c, w);
+}
+
+frozen* tree_freeze(tree* t) {
+    frozen* f = malloc(sizeof(frozen));
+    Assert(f != NULL, __func__, "malloc error");
+    f->n = t->s;
+    f->m = NULL;
+    f->z = 0;
+    f->k = _frozen_alloc((f->n + 1) * sizeof(long));
+    f->c = _frozen_alloc((f->n + 1) * sizeof(unsigned));
+    f->w = _frozen_alloc((f->n + 1) * sizeof(unsigned long));
+    tree_freeze_into(t, f);
+    return f;
+}
+
+void tree_freeze_into(tree* t, frozen* f) {
+    f->n = t->s;
+    // slot 0 is never read, but is saved with the rest
+    f->k[0] = 0;
+    f->c[0] = 0;
+    f->w[0] = 0;
+    tree_cursor c;
+    tree_cursor_first(&c, t);
+    unsigned long w = 0;
+    _frozen_fill(f, 1, &c, &w);
+    Assert(c.n == NULL, __func__, "tree size %lu is off", t->s);
+    f->s = w;
+}
+
+size_t frozen_lower_bound(frozen* f, long d) {
+    const long* k = f->k;
+    size_t n = f->n;
+    size_t i = 1;
+    while (i <= n) {
+        // prefetch is a hint, running off the end is harmless
+        __builtin_prefetch(k + FROZEN_LINE * i);
+        i = 2 * i + (k[i] < d);
+    }
+    // undo the right turns, and the last left one
+    i >>= __builtin_ffsl(~i);
+    return i;
+}
+
+size_t frozen_search(frozen* f, long d) {
+    size_t i = frozen_lower_bound(f, d);
+    return i != 0 && f->k[i] == d ? i : 0;
+}
+
+unsigned frozen_count(frozen* f, long d) {
+    size_t i = frozen_search(f, d);
+    return i == 0 ? 0 : f->c[i];
+}
+
+static unsigned long _frozen_rank(frozen* f, long d) {
+    size_t i = frozen_lower_bound(f, d);
+    return i == 0 ? f->s : f->w[i];
+}
+
+unsigned long frozen_count_range(frozen* f, long lo, long hi) {
+    if (lo >= hi) return 0;
+    return _frozen_rank(f, hi) - _frozen_rank(f, lo);
+}
+
+/*
+    the slots under i, in order, into k and c from *j on
+*/
+static void _frozen_inorder(frozen* f, size_t i, long* k, unsigned* c, size_t* j) {
+    if (i > f->n) return;
+    _frozen_inorder(f, 2 * i, k, c, j);
+    k[*j] = f->k[i];
+    c[*j] = f->c[i];
+    *j += 1;
+    _frozen_inorder(f, 2 * i + 1, k, c, j);
+}
+
+tree* frozen_thaw(frozen* f, unsigned flags) {
+    long* k = malloc(sizeof(long) * (f->n + 1));
+    unsigned* c = malloc(sizeof(unsigned) * (f->n + 1));
+    Assert(k != NULL && c != NULL, __func__, "malloc error");
+    size_t j = 0;
+    _frozen_inorder(f, 1, k, c, &j);
+    // a mapped file isn't trusted to be in order
+    for (j = 0; j < f->n; j++) {
+        if (c[j] == 0 || (j > 0 && k[j - 1] >= k[j])) {
+            free(k);
+            free(c);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    tree* t = tree_build_sorted_flags(k, c, f->n, flags);
+    free(k);
+    free(c);
+    return t;
+}
+
+void frozen_free(frozen* f) {
+    if (f->m != NULL) {
+        munmap(f->m, f->z);
+    } else {
+        free(f->k);
+        free(f->c);
+        free(f->w);
+    }
+    free(f);
+}
@@ -0,0 +1,68 @@
+#include <stddef.h>
+
+#include "tree.h"
+
+#ifndef TREE_FROZEN_H
+#define TREE_FROZEN_H
+
+/*
+    an immutable snapshot of a tree for read-mostly phases.  the
+    keys sit in one contiguous array in eytzinger (bfs) order:
+    the children of slot i are 2i and 2i + 1, so a search walks
+    down a single array and can prefetch the next levels instead
+    of chasing scattered node pointers.  slots are 1-based, slot
+    0 means "none"
+*/
+typedef struct frozen frozen;
+struct frozen {
+    long* k; // keys, k[1..n]
+    unsigned* c; // counts, c[i] goes with k[i]
+    unsigned long* w; // w[i] is the total count of keys < k[i]
+    size_t n; // distinct keys
+    unsigned long s; // total count
+    void* m; // the file mapping the arrays live in (see snapshot.h), or NULL
+    size_t z; // and its length
+};
+
+/*
+    snapshot t, in O(n).  t is left alone and can be freed
+*/
+frozen* tree_freeze(tree* t);
+
+/*
+    tree_freeze into arrays the caller has set up in f, k, c and w
+    each with room for t's size + 1 slots, a file mapping say.  sets
+    n and s, and leaves m and z alone
+*/
+void tree_freeze_into(tree* t, frozen* f);
+
+/*
+    slot holding d, or 0
+*/
+size_t frozen_search(frozen* f, long d);
+
+/*
+    slot of the smallest key >= d, or 0
+*/
+size_t frozen_lower_bound(frozen* f, long d);
+
+/*
+    the count of d, 0 if absent
+*/
+unsigned frozen_count(frozen* f, long d);
+
+/*
+    total count of the values in [lo, hi)
+*/
+unsigned long frozen_count_range(frozen* f, long lo, long hi);
+
+/*
+    a mutable tree with f's keys and counts, in O(n), with the given
+    TREE_* flags.  f is left alone.  NULL, with errno EINVAL, if
+    f's keys aren't in order, as a damaged file's may not be
+*/
+tree* frozen_thaw(frozen* f, unsigned flags);
+
+void frozen_free(frozen* f);
+
+#endif //TREE_FROZEN_H
@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,6 +10,10 @@
 #include "../tree-node/tree_node.h"
 
 #include "tree.h"
+#include "btree.h"
+#include "rcu.h"
+#include "cow.h"
+#include "shard.h"
 #include "test-support.h"
 
 void test_many_loop(int start, int check, int cnt, long* nums) {
@@ -41,7 +47,277 @@ void test_many() {
     }
 }
 
+/*
+    random inserts and removes (with repeats) against a
+    count per key, checking the tree as we go
+*/
+void test_churn() {
+    printf("testing random churn\n");
+    int cnt = 500;
+    unsigned counts[cnt];
+    for (int i = 0; i < cnt; i++) counts[i] = 0;
+    srand(1);
+    tree* t = tree_new();
+    unsigned long s = 0;
+    for (int i = 0; i < 200000; i++) {
+        long d = rand() % cnt;
+        if (rand() % 2) {
+            tree_insert(t, d);
+            if (counts[d]++ == 0) s++;
+        } else {
+            assert(tree_remove(t, d) == (counts[d] > 0));
+            if (counts[d] > 0 && --counts[d] == 0) s--;
+        }
+        assert(tree_size(t) == s);
+        if (i % 1000 == 0) tree_node_check(_get_root(t));
+    }
+    for (long d = 0; d < cnt; d++) {
+        tree_node* n = tree_search(t, d);
+        if (counts[d] == 0) assert(n == NULL);
+        else assert(n != NULL && n->c == counts[d]);
+    }
+    _tree_free(t);
+}
+
+/*
+    the same churn through the b-tree, with counts large enough
+    to split and merge nodes at every level
+*/
+void test_btree_churn() {
+    printf("testing random btree churn\n");
+    int cnt = 20000;
+    unsigned* counts = calloc(cnt, sizeof(unsigned));
+    srand(2);
+    btree* b = btree_new();
+    unsigned long s = 0;
+    for (int i = 0; i < 1000000; i++) {
+        long d = rand() % cnt;
+        // lean towards inserts at first and removes later, so it grows and shrinks
+        if (rand() % 4 < (i < 500000 ? 3 : 1)) {
+            btree_insert(b, d);
+            if (counts[d]++ == 0) s++;
+        } else {
+            assert(btree_remove(b, d) == (counts[d] > 0));
+            if (counts[d] > 0 && --counts[d] == 0) s--;
+        }
+        assert(btree_size(b) == s);
+        if (i % 10000 == 0) assert(_btree_check(b) == s);
+    }
+    for (long d = 0; d < cnt; d++) {
+        assert(btree_search(b, d) == counts[d]);
+    }
+    btree_free(b);
+    free(counts);
+}
+
+/*
+    lock free readers against a writer: the even keys are always
+    in the tree and the odd ones come and go, so every search for
+    an even key and every count of them in a range must come out
+    the same no matter what the writer is doing
+*/
+struct rcu_arg {
+    rtree* t;
+    long n;
+    _Atomic bool* done;
+    unsigned long reads;
+};
+
+static bool rcu_count_even(long d, unsigned c, void* arg) {
+    if (d % 2 == 0) *(long*) arg += 1;
+    return true;
+}
+
+static void* rcu_reader(void* arg) {
+    struct rcu_arg* a = arg;
+    rtree_reader* r = rtree_reader_new(a->t);
+    unsigned long x = 1;
+    while (!atomic_load(a->done)) {
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+        long d = (long) ((x >> 33) % a->n) & ~1L;
+        rtree_read_lock(r);
+        assert(rtree_search(a->t, d) == 1);
+        if (a->reads % 64 == 0) {
+            long evens = 0;
+            rtree_range(a->t, d, d + 200, rcu_count_even, &evens);
+            long want = d + 200 > a->n ? (a->n - d + 1) / 2 : 100;
+            assert(evens == want);
+        }
+        rtree_read_unlock(r);
+        a->reads++;
+    }
+    return NULL;
+}
+
+void test_rcu() {
+    printf("testing rcu readers against a writer\n");
+    long n = 20000;
+    int readers = 4;
+    rtree* t = rtree_new(readers);
+    for (long d = 0; d < n; d += 2) {
+        rtree_insert(t, d);
+    }
+    _Atomic bool done = false;
+    pthread_t th[readers];
+    struct rcu_arg args[readers];
+    for (int i = 0; i < readers; i++) {
+        args[i] = (struct rcu_arg) {t, n, &done, 0};
+        assert(pthread_create(&th[i], NULL, rcu_reader, &args[i]) == 0);
+    }
+    srand(3);
+    for (int i = 0; i < 200000; i++) {
+        long d = (rand() % n) | 1;
+        if (rand() % 2) rtree_insert(t, d);
+        else rtree_remove(t, d);
+    }
+    atomic_store(&done, true);
+    for (int i = 0; i < readers; i++) {
+        pthread_join(th[i], NULL);
+        assert(args[i].reads > 0);
+    }
+    _rtree_check(t);
+    rtree_free(t);
+}
+
+/*
+    readers scanning snapshots against a writer: every version has
+    all the even keys, a snapshot scans the same twice however much
+    is written in between, and when everyone is done only the live
+    version's nodes are left
+*/
+struct cow_arg {
+    vtree* t;
+    long n;
+    _Atomic bool* done;
+    unsigned long scans;
+};
+
+struct cow_scan {
+    long last;
+    unsigned long keys;
+    unsigned long evens;
+    unsigned long sum;
+};
+
+static bool cow_add(long d, unsigned c, void* arg) {
+    struct cow_scan* s = arg;
+    assert(d > s->last);
+    s->last = d;
+    s->keys++;
+    if (d % 2 == 0) s->evens++;
+    s->sum = s->sum * 31 + (unsigned long) d * c;
+    return true;
+}
+
+static void* cow_reader(void* arg) {
+    struct cow_arg* a = arg;
+    while (!atomic_load(a->done)) {
+        vview* v = vtree_snapshot(a->t);
+        struct cow_scan x = {LONG_MIN, 0, 0, 0};
+        vview_inorder(v, cow_add, &x);
+        assert(x.keys == vview_size(v));
+        assert(x.evens == (unsigned long) a->n / 2);
+        sched_yield();
+        struct cow_scan y = {LONG_MIN, 0, 0, 0};
+        vview_inorder(v, cow_add, &y);
+        assert(y.keys == x.keys && y.sum == x.sum);
+        vview_release(v);
+        a->scans++;
+    }
+    return NULL;
+}
+
+void test_cow() {
+    printf("testing copy-on-write snapshots against a writer\n");
+    long n = 20000;
+    int readers = 4;
+    vtree* t = vtree_new();
+    for (long d = 0; d < n; d += 2) {
+        vtree_insert(t, d);
+    }
+    _Atomic bool done = false;
+    pthread_t th[readers];
+    struct cow_arg args[readers];
+    for (int i = 0; i < readers; i++) {
+        args[i] = (struct cow_arg) {t, n, &done, 0};
+        assert(pthread_create(&th[i], NULL, cow_reader, &args[i]) == 0);
+    }
+    srand(5);
+    for (int i = 0; i < 200000; i++) {
+        long d = (rand() % n) | 1;
+        if (rand() % 2) vtree_insert(t, d);
+        else vtree_remove(t, d);
+    }
+    atomic_store(&done, true);
+    for (int i = 0; i < readers; i++) {
+        pthread_join(th[i], NULL);
+        assert(args[i].scans > 0);
+    }
+    _vtree_check(t);
+    assert(t->n == vtree_size(t));
+    vtree_free(t);
+}
+
+/*
+    writers on every shard at once: each thread inserts its own
+    keys twice and removes them once, so every key ends up with a
+    count of one whatever the interleaving
+*/
+struct stree_arg {
+    stree* s;
+    long from;
+    long n;
+};
+
+static void* stree_writer(void* arg) {
+    struct stree_arg* a = arg;
+    for (long d = a->from; d < a->from + a->n; d++) {
+        stree_insert(a->s, d);
+        stree_insert(a->s, d);
+    }
+    for (long d = a->from; d < a->from + a->n; d++) {
+        assert(stree_remove(a->s, d));
+    }
+    return NULL;
+}
+
+static bool stree_count_one(long d, unsigned c, void* arg) {
+    assert(c == 1);
+    long* last = arg;
+    assert(d > *last);
+    *last = d;
+    return true;
+}
+
+void test_stree() {
+    printf("testing sharded tree writers\n");
+    int writers = 4;
+    long n = 20000;
+    long splits[] = {n / 2, n, 3 * n / 2};
+    stree* ss[] = {stree_new(16), stree_new_range(splits, 4)};
+    for (int e = 0; e < 2; e++) {
+        pthread_t th[writers];
+        struct stree_arg args[writers];
+        for (int i = 0; i < writers; i++) {
+            args[i] = (struct stree_arg) {ss[e], i * n / 2, n / 2};
+            assert(pthread_create(&th[i], NULL, stree_writer, &args[i]) == 0);
+        }
+        for (int i = 0; i < writers; i++) {
+            pthread_join(th[i], NULL);
+        }
+        assert(stree_size(ss[e]) == (unsigned long) (writers * n / 2));
+        long last = -1;
+        assert(stree_inorder(ss[e], stree_count_one, &last) == (unsigned long) (writers * n / 2));
+        stree_free(ss[e]);
+    }
+}
+
 int main() {
     test_many();
+    test_churn();
+    test_btree_churn();
+    test_rcu();
+    test_cow();
+    test_stree();
     return 0;
 }
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+
+#include "../log/log.h"
+#include "release.h"
+
+#include "tree.h"
+#include "pathtree.h"
+#include "rotate.h"
+
+ptree* ptree_new() {
+    ptree* t = malloc(sizeof(ptree));
+    Assert(t != NULL, __func__, "malloc error");
+    t->r = NULL;
+    t->s = 0;
+    t->a = slab_new(sizeof(ptree_node));
+    return t;
+}
+
+TREE_ROTATIONS(_ptree, ptree_node)
+
+static ptree_node* _ptree_rebalance(ptree_node* n) {
+    if (n->b == 2) return n->r->b >= 0 ? _ptree_right_right(n) : _ptree_right_left(n);
+    return n->l->b <= 0 ? _ptree_left_left(n) : _ptree_left_right(n);
+}
+
+void ptree_insert(ptree* t, long d) {
+    ptree_node** path[TREE_HEIGHT_MAX];
+    int h = 0;
+    ptree_node** link = &t->r;
+    while (*link != NULL) {
+        ptree_node* n = *link;
+        if (d == n->d) {
+            n->c += 1;
+            return;
+        }
+        path[h++] = link;
+        link = d < n->d ? &n->l : &n->r;
+    }
+    ptree_node* x = slab_alloc(t->a);
+    x->l = NULL;
+    x->r = NULL;
+    x->d = d;
+    x->c = 1;
+    x->b = 0;
+    *link = x;
+    t->s += 1;
+    // retrace, until a node absorbs the growth or a rotation undoes it
+    while (h > 0) {
+        link = path[--h];
+        ptree_node* n = *link;
+        n->b += d < n->d ? -1 : 1;
+        if (n->b == 0) return;
+        if (n->b == 2 || n->b == -2) {
+            *link = _ptree_rebalance(n);
+            return;
+        }
+    }
+}
+
+ptree_node* ptree_search(ptree* t, long d) {
+    ptree_node* n = t->r;
+    while (n != NULL && n->d != d) {
+        n = d < n->d ? n->l : n->r;
+    }
+    return n;
+}
+
+bool ptree_remove(ptree* t, long d) {
+    ptree_node** path[TREE_HEIGHT_MAX];
+    bool right[TREE_HEIGHT_MAX]; // the side taken from each node on the path
+    int h = 0;
+    ptree_node** link = &t->r;
+    while (*link != NULL && (*link)->d != d) {
+        right[h] = d > (*link)->d;
+        path[h++] = link;
+        link = right[h - 1] ? &(*link)->r : &(*link)->l;
+    }
+    ptree_node* n = *link;
+    if (n == NULL) return false;
+    if (n->c > 1) {
+        n->c -= 1;
+        return true;
+    }
+    if (n->l == NULL || n->r == NULL) {
+        *link = n->l != NULL ? n->l : n->r;
+    } else {
+        // put the successor s in n's place, the path going through s
+        int k = h;
+        right[h] = true;
+        path[h++] = link;
+        ptree_node** sl = &n->r;
+        while ((*sl)->l != NULL) {
+            right[h] = false;
+            path[h++] = sl;
+            sl = &(*sl)->l;
+        }
+        ptree_node* s = *sl;
+        *sl = s->r;
+        s->l = n->l;
+        s->r = n->r;
+        s->b = n->b;
+        *link = s;
+        if (h > k + 1) path[k + 1] = &s->r;
+    }
+    slab_release(t->a, n);
+    t->s -= 1;
+    // retrace, until the height stops shrinking
+    while (h > 0) {
+        link = path[--h];
+        ptree_node* x = *link;
+        x->b += right[h] ? -1 : 1;
+        if (x->b == 1 || x->b == -1) break;
+        if (x->b == 2 || x->b == -2) {
+            x = *link = _ptree_rebalance(x);
+            if (x->b != 0) break;
+        }
+    }
+    return true;
+}
+
+unsigned long ptree_inorder(ptree* t, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    ptree_node* stack[TREE_HEIGHT_MAX];
+    int h = 0;
+    unsigned long k = 0;
+    ptree_node* n = t->r;
+    while (n != NULL || h > 0) {
+        while (n != NULL) {
+            stack[h++] = n;
+            n = n->l;
+        }
+        n = stack[--h];
+        k++;
+        if (!f(n->d, n->c, arg)) break;
+        n = n->r;
+    }
+    return k;
+}
+
+unsigned long ptree_size(ptree* t) {
+    return t->s;
+}
+
+void ptree_free(ptree* t) {
+    slab_free(t->a);
+    free(t);
+}
+
+#ifdef _UNIT_TEST
+static int _ptree_check_node(ptree_node* n, unsigned long* s) {
+    if (n == NULL) return 0;
+    *s += 1;
+    if (n->l != NULL) Assert(n->l->d < n->d, __func__, "%li out of order", n->l->d);
+    if (n->r != NULL) Assert(n->r->d > n->d, __func__, "%li out of order", n->r->d);
+    int hl = _ptree_check_node(n->l, s);
+    int hr = _ptree_check_node(n->r, s);
+    Assert(hr - hl == n->b, __func__, "balance factor %d for %li, heights %d %d", n->b, n->d, hl, hr);
+    return (hl > hr ? hl : hr) + 1;
+}
+
+/*
+    check order and balance factors, return the height
+*/
+STATIC int _ptree_check(ptree* t) {
+    unsigned long s = 0;
+    int h = _ptree_check_node(t->r, &s);
+    Assert(s == t->s, __func__, "%lu nodes, size says %lu", s, t->s);
+    return h;
+}
+#endif
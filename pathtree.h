@@ -0,0 +1,66 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "slab.h"
+
+#ifndef TREE_PATHTREE_H
+#define TREE_PATHTREE_H
+
+/*
+    an avl tree without parent pointers.  updates record the
+    links they follow on a fixed size stack (TREE_HEIGHT_MAX in
+    rotate.h) and retrace by popping it, rewriting the parent's
+    link (or the root) in place after a rotation.  nodes are 32
+    bytes against 40, come from a tree owned slab, and nothing is
+    stored to keep parent pointers up to date
+*/
+typedef struct ptree_node ptree_node;
+struct ptree_node {
+    ptree_node* l; // left child
+    ptree_node* r; // right child
+    long d; // data
+    unsigned c; // count
+    short b; // balance factor
+};
+
+typedef struct ptree ptree;
+struct ptree {
+    ptree_node* r; // root node
+    unsigned long s; // distinct keys, as tree->s
+    slab* a; // node allocator
+};
+
+/*
+    create an empty tree
+*/
+ptree* ptree_new();
+
+/*
+    insert a data into the tree
+*/
+void ptree_insert(ptree* t, long d);
+
+/*
+    the node holding d, or NULL
+*/
+ptree_node* ptree_search(ptree* t, long d);
+
+/*
+    remove one instance of d, true if there was one
+*/
+bool ptree_remove(ptree* t, long d);
+
+/*
+    call f on each key and its count, in order, until f returns
+    false.  returns the number of keys passed to f
+*/
+unsigned long ptree_inorder(ptree* t, bool (*f)(long d, unsigned c, void* arg), void* arg);
+
+/*
+    the number of distinct keys
+*/
+unsigned long ptree_size(ptree* t);
+
+void ptree_free(ptree* t);
+
+#endif //TREE_PATHTREE_H
@@ -0,0 +1,351 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../log/log.h"
+#include "release.h"
+
+#include "tree.h"
+#include "rcu.h"
+#include "rotate.h"
+
+// retired nodes pile up to this before the writer tries to free them
+#define RTREE_RECLAIM 64
+
+rtree* rtree_new(size_t m) {
+    rtree* t = malloc(sizeof(rtree));
+    Assert(t != NULL, __func__, "malloc error");
+    atomic_init(&t->r, NULL);
+    atomic_init(&t->s, 0);
+    atomic_init(&t->e, 1);
+    pthread_mutex_init(&t->w, NULL);
+    t->g = 0;
+    t->readers = aligned_alloc(64, (m == 0 ? 1 : m) * sizeof(rtree_reader));
+    Assert(t->readers != NULL, __func__, "malloc error");
+    for (size_t i = 0; i < m; i++) {
+        atomic_init(&t->readers[i].e, 0);
+        t->readers[i].t = t;
+    }
+    atomic_init(&t->nr, 0);
+    t->mr = m;
+    t->limbo = NULL;
+    t->nl = 0;
+    t->ml = 0;
+    return t;
+}
+
+rtree_reader* rtree_reader_new(rtree* t) {
+    size_t i = atomic_fetch_add(&t->nr, 1);
+    Assert(i < t->mr, __func__, "more than %lu readers", (unsigned long) t->mr);
+    return t->readers + i;
+}
+
+void rtree_read_lock(rtree_reader* r) {
+    atomic_store(&r->e, atomic_load(&r->t->e));
+    // the writer either sees this reader, or the reader sees the new root
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void rtree_read_unlock(rtree_reader* r) {
+    atomic_store_explicit(&r->e, 0, memory_order_release);
+}
+
+static rtree_node* _rtree_root(rtree* t) {
+    return atomic_load_explicit(&t->r, memory_order_acquire);
+}
+
+unsigned rtree_search(rtree* t, long d) {
+    rtree_node* n = _rtree_root(t);
+    while (n != NULL && n->d != d) {
+        n = d < n->d ? n->l : n->r;
+    }
+    return n == NULL ? 0 : n->c;
+}
+
+unsigned long rtree_range(rtree* t, long lo, long hi, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    rtree_node* stack[TREE_HEIGHT_MAX];
+    int h = 0;
+    unsigned long k = 0;
+    rtree_node* n = _rtree_root(t);
+    while (n != NULL || h > 0) {
+        // down to the lower bound, stacking the nodes still to visit
+        while (n != NULL) {
+            if (n->d >= lo) {
+                stack[h++] = n;
+                n = n->l;
+            } else n = n->r;
+        }
+        n = stack[--h];
+        if (n->d >= hi) break;
+        k++;
+        if (!f(n->d, n->c, arg)) break;
+        n = n->r;
+    }
+    return k;
+}
+
+unsigned long rtree_size(rtree* t) {
+    return atomic_load_explicit(&t->s, memory_order_relaxed);
+}
+
+/*
+    writer side.  everything below runs under t->w
+*/
+static rtree_node* _rtree_node_new(rtree* t, long d) {
+    rtree_node* n = malloc(sizeof(rtree_node));
+    Assert(n != NULL, __func__, "malloc error");
+    n->l = NULL;
+    n->r = NULL;
+    n->d = d;
+    n->c = 1;
+    n->b = 0;
+    n->g = t->g;
+    return n;
+}
+
+static void _rtree_retire(rtree* t, rtree_node* n) {
+    if (t->nl == t->ml) {
+        t->ml = t->ml == 0 ? RTREE_RECLAIM * 2 : t->ml * 2;
+        t->limbo = realloc(t->limbo, t->ml * sizeof(rtree_retired));
+        Assert(t->limbo != NULL, __func__, "malloc error");
+    }
+    t->limbo[t->nl].n = n;
+    t->limbo[t->nl].e = 0; // set once the write is published
+    t->nl += 1;
+}
+
+/*
+    a version of n this write can change: n itself if the write
+    made it, otherwise a copy, retiring n
+*/
+static rtree_node* _rtree_own(rtree* t, rtree_node* n) {
+    if (n->g == t->g) return n;
+    rtree_node* x = malloc(sizeof(rtree_node));
+    Assert(x != NULL, __func__, "malloc error");
+    *x = *n;
+    x->g = t->g;
+    _rtree_retire(t, n);
+    return x;
+}
+
+/*
+    n (owned) leaves the tree.  nobody else has seen it
+*/
+static void _rtree_drop(rtree* t, rtree_node* n) {
+    (void) t; // only the Assert reads it
+    Assert(n->g == t->g, __func__, "dropping a published node, %li", n->d);
+    free(n);
+}
+
+/*
+    free what no reader can still reach: nodes retired before the
+    oldest epoch a reader is in
+*/
+static void _rtree_reclaim(rtree* t) {
+    atomic_thread_fence(memory_order_seq_cst);
+    unsigned long m = ULONG_MAX;
+    size_t nr = atomic_load(&t->nr);
+    if (nr > t->mr) nr = t->mr;
+    for (size_t i = 0; i < nr; i++) {
+        unsigned long e = atomic_load(&t->readers[i].e);
+        if (e != 0 && e < m) m = e;
+    }
+    size_t k = 0;
+    while (k < t->nl && t->limbo[k].e < m) {
+        free(t->limbo[k].n);
+        k++;
+    }
+    memmove(t->limbo, t->limbo + k, (t->nl - k) * sizeof(rtree_retired));
+    t->nl -= k;
+}
+
+/*
+    make r the tree, and tag what the write retired with the
+    epoch it is leaving.  readers that enter from here on have a
+    later epoch, and can only see r
+*/
+static void _rtree_publish(rtree* t, rtree_node* r, size_t retired) {
+    atomic_store_explicit(&t->r, r, memory_order_release);
+    unsigned long e = atomic_fetch_add(&t->e, 1);
+    for (size_t i = retired; i < t->nl; i++) {
+        t->limbo[i].e = e;
+    }
+    if (t->nl >= RTREE_RECLAIM) _rtree_reclaim(t);
+}
+
+// the rotations only ever see nodes the write owns
+TREE_ROTATIONS(_rtree, rtree_node)
+
+/*
+    rotate X (owned, b = +-2), first taking ownership of the
+    nodes the rotation changes
+*/
+static rtree_node* _rtree_rebalance(rtree* t, rtree_node* X) {
+    if (X->b == 2) {
+        rtree_node* Z = X->r = _rtree_own(t, X->r);
+        if (Z->b >= 0) return _rtree_right_right(X);
+        Z->l = _rtree_own(t, Z->l);
+        return _rtree_right_left(X);
+    }
+    rtree_node* Z = X->l = _rtree_own(t, X->l);
+    if (Z->b <= 0) return _rtree_left_left(X);
+    Z->r = _rtree_own(t, Z->r);
+    return _rtree_left_right(X);
+}
+
+static rtree_node* _rtree_insert(rtree* t, rtree_node* n, long d, bool* grew) {
+    if (n == NULL) {
+        *grew = true;
+        atomic_fetch_add_explicit(&t->s, 1, memory_order_relaxed);
+        return _rtree_node_new(t, d);
+    }
+    n = _rtree_own(t, n);
+    if (d == n->d) {
+        n->c += 1;
+        *grew = false;
+        return n;
+    }
+    if (d < n->d) {
+        n->l = _rtree_insert(t, n->l, d, grew);
+        if (*grew) n->b -= 1;
+    } else {
+        n->r = _rtree_insert(t, n->r, d, grew);
+        if (*grew) n->b += 1;
+    }
+    if (!*grew) return n;
+    if (n->b == 0) *grew = false;
+    else if (n->b == 2 || n->b == -2) {
+        n = _rtree_rebalance(t, n);
+        *grew = false;
+    }
+    return n;
+}
+
+/*
+    the side of n given by right just got shorter, rebalance and
+    say whether n's subtree did too
+*/
+static rtree_node* _rtree_shrunk(rtree* t, rtree_node* n, bool right, bool* shrunk) {
+    n->b += right ? -1 : 1;
+    if (n->b == 1 || n->b == -1) {
+        *shrunk = false;
+        return n;
+    }
+    if (n->b == 0) return n;
+    n = _rtree_rebalance(t, n);
+    *shrunk = n->b == 0;
+    return n;
+}
+
+static rtree_node* _rtree_remove_min(rtree* t, rtree_node* n, bool* shrunk) {
+    n = _rtree_own(t, n);
+    if (n->l == NULL) {
+        rtree_node* r = n->r;
+        _rtree_drop(t, n);
+        *shrunk = true;
+        return r;
+    }
+    n->l = _rtree_remove_min(t, n->l, shrunk);
+    return *shrunk ? _rtree_shrunk(t, n, false, shrunk) : n;
+}
+
+/*
+    remove one d, which is in the subtree under n
+*/
+static rtree_node* _rtree_remove(rtree* t, rtree_node* n, long d, bool* shrunk) {
+    n = _rtree_own(t, n);
+    if (d < n->d) {
+        n->l = _rtree_remove(t, n->l, d, shrunk);
+        return *shrunk ? _rtree_shrunk(t, n, false, shrunk) : n;
+    }
+    if (d > n->d) {
+        n->r = _rtree_remove(t, n->r, d, shrunk);
+        return *shrunk ? _rtree_shrunk(t, n, true, shrunk) : n;
+    }
+    if (n->c > 1) {
+        n->c -= 1;
+        *shrunk = false;
+        return n;
+    }
+    atomic_fetch_sub_explicit(&t->s, 1, memory_order_relaxed);
+    if (n->l == NULL || n->r == NULL) {
+        rtree_node* c = n->l != NULL ? n->l : n->r;
+        _rtree_drop(t, n);
+        *shrunk = true;
+        return c;
+    }
+    // n takes over its successor, which comes out of the right
+    rtree_node* s = n->r;
+    while (s->l != NULL) s = s->l;
+    n->d = s->d;
+    n->c = s->c;
+    n->r = _rtree_remove_min(t, n->r, shrunk);
+    return *shrunk ? _rtree_shrunk(t, n, true, shrunk) : n;
+}
+
+void rtree_insert(rtree* t, long d) {
+    pthread_mutex_lock(&t->w);
+    t->g += 1;
+    size_t retired = t->nl;
+    bool grew;
+    rtree_node* r = _rtree_insert(t, atomic_load_explicit(&t->r, memory_order_relaxed), d, &grew);
+    _rtree_publish(t, r, retired);
+    pthread_mutex_unlock(&t->w);
+}
+
+bool rtree_remove(rtree* t, long d) {
+    pthread_mutex_lock(&t->w);
+    // nothing is freed while the writer holds the lock
+    bool found = rtree_search(t, d) > 0;
+    if (found) {
+        t->g += 1;
+        size_t retired = t->nl;
+        bool shrunk;
+        rtree_node* r = _rtree_remove(t, atomic_load_explicit(&t->r, memory_order_relaxed), d, &shrunk);
+        _rtree_publish(t, r, retired);
+    }
+    pthread_mutex_unlock(&t->w);
+    return found;
+}
+
+static void _rtree_free_all(rtree_node* n) {
+    if (n == NULL) return;
+    _rtree_free_all(n->l);
+    _rtree_free_all(n->r);
+    free(n);
+}
+
+void rtree_free(rtree* t) {
+    _rtree_free_all(atomic_load(&t->r));
+    for (size_t i = 0; i < t->nl; i++) {
+        free(t->limbo[i].n);
+    }
+    free(t->limbo);
+    free(t->readers);
+    pthread_mutex_destroy(&t->w);
+    free(t);
+}
+
+#ifdef _UNIT_TEST
+static int _rtree_check_node(rtree_node* n, unsigned long* s) {
+    if (n == NULL) return 0;
+    *s += 1;
+    if (n->l != NULL) Assert(n->l->d < n->d, __func__, "%li out of order", n->l->d);
+    if (n->r != NULL) Assert(n->r->d > n->d, __func__, "%li out of order", n->r->d);
+    int hl = _rtree_check_node(n->l, s);
+    int hr = _rtree_check_node(n->r, s);
+    Assert(hr - hl == n->b, __func__, "balance factor %d for %li, heights %d %d", n->b, n->d, hl, hr);
+    return (hl > hr ? hl : hr) + 1;
+}
+
+/*
+    check order and balance factors of the published version,
+    return the height.  no writer may be running
+*/
+STATIC int _rtree_check(rtree* t) {
+    unsigned long s = 0;
+    int h = _rtree_check_node(atomic_load(&t->r), &s);
+    Assert(s == rtree_size(t), __func__, "%lu nodes, size says %lu", s, rtree_size(t));
+    return h;
+}
+#endif
@@ -0,0 +1,110 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef TREE_RCU_H
+#define TREE_RCU_H
+
+/*
+    a read-copy-update avl tree: readers never lock and never
+    wait, writers take turns.  a writer never changes a node a
+    reader can see.  it copies the path it changes (and any
+    sibling a rotation touches), then publishes the new root
+    with one atomic store.  the nodes it replaced are retired,
+    tagged with the epoch, and freed once every reader that
+    could still be looking at them has left its read section.
+
+    each reading thread gets an rtree_reader, and wraps its
+    reads (searches, and range scans with the callback) in
+    rtree_read_lock / rtree_read_unlock.  values handed out in a
+    read section are from one consistent version of the tree
+*/
+typedef struct rtree_node rtree_node;
+struct rtree_node {
+    rtree_node* l; // left child
+    rtree_node* r; // right child
+    long d; // data
+    unsigned c; // count
+    short b; // balance factor
+    unsigned long g; // write that made the node, see rtree->g
+};
+
+typedef struct rtree rtree;
+
+typedef struct rtree_reader rtree_reader;
+struct rtree_reader {
+    /*
+        the epoch the reader entered at, 0 outside of a read
+        section.  a cache line each, so readers don't share
+    */
+    _Alignas(64) _Atomic unsigned long e;
+    rtree* t;
+};
+
+/*
+    a retired node and the epoch it was retired in
+*/
+typedef struct rtree_retired rtree_retired;
+struct rtree_retired {
+    rtree_node* n;
+    unsigned long e;
+};
+
+struct rtree {
+    _Atomic(rtree_node*) r; // root node, the published version
+    _Atomic unsigned long s; // distinct keys
+    _Atomic unsigned long e; // global epoch, from 1
+    pthread_mutex_t w; // held by the writer
+    unsigned long g; // the current write, nodes with this g are unpublished
+    rtree_reader* readers;
+    _Atomic size_t nr; // readers handed out
+    size_t mr; // reader slots
+    rtree_retired* limbo; // retired, not yet freed, in epoch order
+    size_t nl;
+    size_t ml;
+};
+
+/*
+    create an empty tree for up to m reading threads
+*/
+rtree* rtree_new(size_t m);
+
+/*
+    the calling thread's reader.  call once per thread
+*/
+rtree_reader* rtree_reader_new(rtree* t);
+
+void rtree_read_lock(rtree_reader* r);
+void rtree_read_unlock(rtree_reader* r);
+
+/*
+    the count of d, 0 if absent.  in a read section
+*/
+unsigned rtree_search(rtree* t, long d);
+
+/*
+    call f on each key in [lo, hi) and its count, in order, until
+    f returns false.  returns the number of keys passed to f.
+    in a read section
+*/
+unsigned long rtree_range(rtree* t, long lo, long hi, bool (*f)(long d, unsigned c, void* arg), void* arg);
+
+/*
+    insert a data, or remove one instance of it (true if there
+    was one).  writers need no read section and lock internally
+*/
+void rtree_insert(rtree* t, long d);
+bool rtree_remove(rtree* t, long d);
+
+/*
+    the number of distinct keys
+*/
+unsigned long rtree_size(rtree* t);
+
+/*
+    free the tree.  no thread may be using it
+*/
+void rtree_free(rtree* t);
+
+#endif //TREE_RCU_H
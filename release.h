@@ -0,0 +1,18 @@
+#include "../log/log.h"
+
+#ifndef TREE_RELEASE_H
+#define TREE_RELEASE_H
+/*
+    release builds (-DTREE_RELEASE, see `make release`) compile
+    debug logging and internal invariant checks out entirely, so
+    the hot paths don't pay for the calls or their arguments.
+    include after log.h
+*/
+#ifdef TREE_RELEASE
+#undef LOG_DEBUG
+#define LOG_DEBUG(fmt, func, ...) ((void) 0)
+#undef Assert
+#define Assert(c, func, fmt, ...) ((void) 0)
+#endif // TREE_RELEASE
+
+#endif //TREE_RELEASE_H
@@ -0,0 +1,77 @@
+#ifndef TREE_ROTATE_H
+#define TREE_ROTATE_H
+
+/*
+    internals shared by the avl trees without parent pointers
+    (pathtree.c, rcu.c and cow.c)
+*/
+
+/*
+    the most levels a walk can stack: an avl tree of 2^64 nodes
+    is under 93 high
+*/
+#define TREE_HEIGHT_MAX 96
+
+/*
+    the four rotations of tree.c (see the pictures there), without
+    the parent pointers, as static functions prefix##_right_right
+    and so on over a node type with l, r and b.  each returns the
+    new top node, for the caller to store in X's old link, and the
+    links it moves stay pointed at the same subtrees
+*/
+#define TREE_ROTATIONS(prefix, node) \
+static node* prefix##_right_right(node* X) { \
+    node* Z = X->r; \
+    X->r = Z->l; \
+    Z->l = X; \
+    if (Z->b == 0) { \
+        X->b = 1; \
+        Z->b = -1; \
+    } else { \
+        X->b = 0; \
+        Z->b = 0; \
+    } \
+    return Z; \
+} \
+\
+static node* prefix##_right_left(node* X) { \
+    node* Z = X->r; \
+    node* Y = Z->l; \
+    X->r = Y->l; \
+    Z->l = Y->r; \
+    Y->l = X; \
+    Y->r = Z; \
+    X->b = Y->b == 1 ? -1 : 0; \
+    Z->b = Y->b == -1 ? 1 : 0; \
+    Y->b = 0; \
+    return Y; \
+} \
+\
+static node* prefix##_left_left(node* X) { \
+    node* Z = X->l; \
+    X->l = Z->r; \
+    Z->r = X; \
+    if (Z->b == 0) { \
+        X->b = -1; \
+        Z->b = 1; \
+    } else { \
+        X->b = 0; \
+        Z->b = 0; \
+    } \
+    return Z; \
+} \
+\
+static node* prefix##_left_right(node* X) { \
+    node* Z = X->l; \
+    node* Y = Z->r; \
+    X->l = Y->r; \
+    Z->r = Y->l; \
+    Y->r = X; \
+    Y->l = Z; \
+    X->b = Y->b == -1 ? 1 : 0; \
+    Z->b = Y->b == 1 ? -1 : 0; \
+    Y->b = 0; \
+    return Y; \
+}
+
+#endif //TREE_ROTATE_H
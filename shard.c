@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../log/log.h"
+#include "release.h"
+
+#include "tree.h"
+#include "shard.h"
+
+static stree* _stree_new(size_t k) {
+    Assert(k > 0, __func__, "no shards");
+    stree* s = malloc(sizeof(stree));
+    Assert(s != NULL, __func__, "malloc error");
+    s->s = aligned_alloc(64, k * sizeof(stree_shard));
+    Assert(s->s != NULL, __func__, "malloc error");
+    for (size_t i = 0; i < k; i++) {
+        pthread_mutex_init(&s->s[i].m, NULL);
+        // the header lives in the shard, the nodes in its slab
+        tree* t = tree_new_flags(TREE_SLAB);
+        s->s[i].t = *t;
+        free(t);
+    }
+    s->k = k;
+    s->splits = NULL;
+    return s;
+}
+
+stree* stree_new(size_t k) {
+    return _stree_new(k);
+}
+
+stree* stree_new_range(const long* splits, size_t k) {
+    stree* s = _stree_new(k);
+    if (k > 1) {
+        s->splits = malloc((k - 1) * sizeof(long));
+        Assert(s->splits != NULL, __func__, "malloc error");
+        memcpy(s->splits, splits, (k - 1) * sizeof(long));
+        for (size_t i = 1; i < k - 1; i++) {
+            Assert(splits[i - 1] < splits[i], __func__, "split keys out of order at %lu", (unsigned long) i);
+        }
+    }
+    return s;
+}
+
+/*
+    the shard d lives in
+*/
+static stree_shard* _stree_shard(stree* s, long d) {
+    if (s->splits == NULL) {
+        // fibonacci hashing, the high bits are the well mixed ones
+        unsigned long h = (unsigned long) d * 0x9e3779b97f4a7c15UL;
+        return s->s + (h >> 32) % s->k;
+    }
+    // the number of split keys <= d
+    size_t lo = 0;
+    size_t hi = s->k - 1;
+    while (lo < hi) {
+        size_t m = (lo + hi) / 2;
+        if (s->splits[m] <= d) lo = m + 1;
+        else hi = m;
+    }
+    return s->s + lo;
+}
+
+void stree_insert(stree* s, long d) {
+    stree_shard* x = _stree_shard(s, d);
+    pthread_mutex_lock(&x->m);
+    tree_insert(&x->t, d);
+    pthread_mutex_unlock(&x->m);
+}
+
+unsigned stree_search(stree* s, long d) {
+    stree_shard* x = _stree_shard(s, d);
+    pthread_mutex_lock(&x->m);
+    tree_node* n = tree_search(&x->t, d);
+    unsigned c = n == NULL ? 0 : n->c;
+    pthread_mutex_unlock(&x->m);
+    return c;
+}
+
+bool stree_remove(stree* s, long d) {
+    stree_shard* x = _stree_shard(s, d);
+    pthread_mutex_lock(&x->m);
+    bool r = tree_remove(&x->t, d);
+    pthread_mutex_unlock(&x->m);
+    return r;
+}
+
+/*
+    sift heap entry i down: a min heap of cursors on their key
+*/
+static void _stree_sift(tree_cursor* h, size_t n, size_t i) {
+    while (true) {
+        size_t m = i;
+        size_t l = 2 * i + 1;
+        if (l < n && h[l].n->d < h[m].n->d) m = l;
+        if (l + 1 < n && h[l + 1].n->d < h[m].n->d) m = l + 1;
+        if (m == i) return;
+        tree_cursor c = h[i];
+        h[i] = h[m];
+        h[m] = c;
+        i = m;
+    }
+}
+
+/*
+    range shards are already in order, one after the other
+*/
+static unsigned long _stree_concat(stree* s, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    unsigned long k = 0;
+    for (size_t i = 0; i < s->k; i++) {
+        tree_cursor c;
+        for (tree_node* n = tree_cursor_first(&c, &s->s[i].t); n != NULL; n = tree_cursor_next(&c)) {
+            k++;
+            if (!f(n->d, n->c, arg)) return k;
+        }
+    }
+    return k;
+}
+
+/*
+    hashed shards interleave, take the least key of all the
+    shard cursors each time round
+*/
+static unsigned long _stree_merge(stree* s, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    tree_cursor* h = malloc(s->k * sizeof(tree_cursor));
+    Assert(h != NULL, __func__, "malloc error");
+    size_t n = 0;
+    for (size_t i = 0; i < s->k; i++) {
+        if (tree_cursor_first(&h[n], &s->s[i].t) != NULL) n++;
+    }
+    for (size_t i = n; i-- > 0;) {
+        _stree_sift(h, n, i);
+    }
+    unsigned long k = 0;
+    while (n > 0) {
+        k++;
+        if (!f(h[0].n->d, h[0].n->c, arg)) break;
+        if (tree_cursor_next(&h[0]) == NULL) h[0] = h[--n];
+        _stree_sift(h, n, 0);
+    }
+    free(h);
+    return k;
+}
+
+unsigned long stree_inorder(stree* s, bool (*f)(long d, unsigned c, void* arg), void* arg) {
+    // always in shard order, so walks can't deadlock each other
+    for (size_t i = 0; i < s->k; i++) {
+        pthread_mutex_lock(&s->s[i].m);
+    }
+    unsigned long k = s->splits != NULL ? _stree_concat(s, f, arg) : _stree_merge(s, f, arg);
+    for (size_t i = s->k; i-- > 0;) {
+        pthread_mutex_unlock(&s->s[i].m);
+    }
+    return k;
+}
+
+unsigned long stree_size(stree* s) {
+    unsigned long z = 0;
+    for (size_t i = 0; i < s->k; i++) {
+        pthread_mutex_lock(&s->s[i].m);
+        z += tree_size(&s->s[i].t);
+        pthread_mutex_unlock(&s->s[i].m);
+    }
+    return z;
+}
+
+void stree_free(stree* s) {
+    for (size_t i = 0; i < s->k; i++) {
+        pthread_mutex_destroy(&s->s[i].m);
+        slab_free(s->s[i].t.a); // every node is in it
+    }
+    free(s->s);
+    free(s->splits);
+    free(s);
+}
@@ -0,0 +1,72 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tree.h"
+
+#ifndef TREE_SHARD_H
+#define TREE_SHARD_H
+
+/*
+    a tree split into k independent shards, each a slab backed
+    tree with its own lock, so writers to different shards never
+    meet.  keys go to shards by hash, or by range when split keys
+    are given.  ordered walks merge the shards
+*/
+typedef struct stree_shard stree_shard;
+struct stree_shard {
+    /*
+        the lock and the tree header both start on a line of their
+        shard's own, so one shard's updates never dirty another's
+    */
+    _Alignas(64) pthread_mutex_t m;
+    tree t;
+};
+
+typedef struct stree stree;
+struct stree {
+    stree_shard* s;
+    size_t k; // shards
+    long* splits; // k - 1 ascending split keys, NULL when hashed
+};
+
+/*
+    k shards, by hash
+*/
+stree* stree_new(size_t k);
+
+/*
+    k shards by range: shard i holds [splits[i - 1], splits[i]),
+    the first and last are open ended.  splits holds k - 1
+    ascending keys, and is copied
+*/
+stree* stree_new_range(const long* splits, size_t k);
+
+void stree_insert(stree* s, long d);
+
+/*
+    the count of d, 0 if absent
+*/
+unsigned stree_search(stree* s, long d);
+
+/*
+    remove one instance of d, true if there was one
+*/
+bool stree_remove(stree* s, long d);
+
+/*
+    call f on each key and its count, in order across all shards,
+    until f returns false.  returns the number of keys passed to
+    f.  every shard is locked for the walk, so f sees one version
+    of the whole tree and must not change it
+*/
+unsigned long stree_inorder(stree* s, bool (*f)(long d, unsigned c, void* arg), void* arg);
+
+/*
+    the number of distinct keys
+*/
+unsigned long stree_size(stree* s);
+
+void stree_free(stree* s);
+
+#endif //TREE_SHARD_H
@@ -0,0 +1,79 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../log/log.h"
+#include "release.h"
+#include "../tree-node/tree_node.h"
+
+#include "slab.h"
+
+// chunks double in size from the first up to the last
+#define SLAB_FIRST_CHUNK 1024
+#define SLAB_MAX_CHUNK (1UL << 20)
+
+slab* slab_new(size_t e) {
+    slab* a = malloc(sizeof(slab));
+    Assert(a != NULL, __func__, "malloc error");
+    Assert(e >= sizeof(void*), __func__, "element smaller than a pointer: %lu", (unsigned long) e);
+    a->e = e;
+    a->h = NULL;
+    a->f = NULL;
+    a->u = 0;
+    a->z = 0;
+    return a;
+}
+
+static void _slab_grow(slab* a) {
+    unsigned long z = a->z == 0 ? SLAB_FIRST_CHUNK : a->z * 2;
+    if (z > SLAB_MAX_CHUNK) z = SLAB_MAX_CHUNK;
+    slab_chunk* c = malloc(sizeof(slab_chunk) + z * a->e);
+    Assert(c != NULL, __func__, "malloc error");
+    c->n = a->h;
+    a->h = c;
+    a->u = 0;
+    a->z = z;
+}
+
+void* slab_alloc(slab* a) {
+    void* x;
+    if (a->f != NULL) {
+        x = a->f;
+        a->f = *(void**) x;
+    } else {
+        if (a->u == a->z) _slab_grow(a);
+        x = a->h->nodes + a->u * a->e;
+        a->u += 1;
+    }
+    return x;
+}
+
+void slab_release(slab* a, void* x) {
+    *(void**) x = a->f;
+    a->f = x;
+}
+
+tree_node* slab_node_new(slab* a, long d) {
+    Assert(a->e >= sizeof(tree_node), __func__, "element smaller than a node: %lu", (unsigned long) a->e);
+    tree_node* n = slab_alloc(a);
+    n->p = NULL;
+    n->l = NULL;
+    n->r = NULL;
+    n->d = d;
+    n->c = 1;
+    n->b = 0;
+    return n;
+}
+
+void slab_node_free(slab* a, tree_node* n) {
+    slab_release(a, n);
+}
+
+void slab_free(slab* a) {
+    slab_chunk* c = a->h;
+    while (c != NULL) {
+        slab_chunk* n = c->n;
+        free(c);
+        c = n;
+    }
+    free(a);
+}
@@ -0,0 +1,64 @@
+#include <stddef.h>
+
+#include "../tree-node/tree_node.h"
+
+#ifndef TREE_SLAB_H
+#define TREE_SLAB_H
+
+/*
+    slab allocator for tree nodes.  nodes are carved out of
+    large contiguous chunks by bumping a pointer; removed nodes
+    go on a free list (threaded through their first word) and
+    are handed out again before the chunk is bumped.  the whole
+    slab, and hence every node in it, is released with one free
+    per chunk.  elements can be bigger than a tree_node (which
+    must come first), for trees that hang extra data off their
+    nodes, or any size of at least a pointer when only used
+    through slab_alloc
+*/
+typedef struct slab_chunk slab_chunk;
+struct slab_chunk {
+    slab_chunk* n; // next (older) chunk
+    _Alignas(tree_node) char nodes[];
+};
+
+typedef struct slab slab;
+struct slab {
+    slab_chunk* h; // most recent chunk
+    void* f; // free list
+    unsigned long u; // nodes used in the head chunk
+    unsigned long z; // nodes in the head chunk
+    size_t e; // element size
+};
+
+/*
+    create an empty slab of elements of e bytes
+*/
+slab* slab_new(size_t e);
+
+/*
+    allocate an uninitialized element
+*/
+void* slab_alloc(slab* a);
+
+/*
+    return an element to the slab
+*/
+void slab_release(slab* a, void* x);
+
+/*
+    allocate a node, initialized as tree_node_new would
+*/
+tree_node* slab_node_new(slab* a, long d);
+
+/*
+    return a node to the slab
+*/
+void slab_node_free(slab* a, tree_node* n);
+
+/*
+    release every chunk, and the slab
+*/
+void slab_free(slab* a);
+
+#endif //TREE_SLAB_H
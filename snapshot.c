@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "release.h"
+#include "../tree-node/tree_node.h"
+
+#include "tree.h"
+#include "frozen.h"
+#include "snapshot.h"
+
+_Static_assert(sizeof(snapshot_header) == 64, "snapshot header isn't 64 bytes");
+
+static size_t _snapshot_pad(size_t z) {
+    return (z + 63) & ~(size_t) 63;
+}
+
+/*
+    where the k, c and w sections start for n keys, returns the
+    file length
+*/
+static size_t _snapshot_layout(size_t n, size_t* off) {
+    off[0] = sizeof(snapshot_header);
+    off[1] = off[0] + _snapshot_pad((n + 1) * sizeof(long));
+    off[2] = off[1] + _snapshot_pad((n + 1) * sizeof(unsigned));
+    return off[2] + _snapshot_pad((n + 1) * sizeof(unsigned long));
+}
+
+/*
+    fnv-1a a word at a time.  sections are padded to 64 bytes, so
+    the file body is always whole words
+*/
+static uint64_t _snapshot_sum(uint64_t h, const void* p, size_t z) {
+    const unsigned char* b = p;
+    for (size_t i = 0; i < z; i += 8) {
+        uint64_t w;
+        memcpy(&w, b + i, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+bool snapshot_sync_dir(const char* path) {
+    const char* e = strrchr(path, '/');
+    char* d = e == NULL ? strdup(".") : strndup(path, e == path ? 1 : (size_t) (e - path));
+    Assert(d != NULL, __func__, "malloc error");
+    int fd = open(d, O_RDONLY);
+    free(d);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+bool tree_save(tree* t, const char* path) {
+    size_t z = strlen(path);
+    char* tmp = malloc(z + 5);
+    Assert(tmp != NULL, __func__, "malloc error");
+    memcpy(tmp, path, z);
+    memcpy(tmp + z, ".tmp", 5);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(tmp);
+        return false;
+    }
+    // the tree is frozen straight into a mapping of the file, the
+    // padding is the zeros ftruncate leaves
+    size_t off[3];
+    z = _snapshot_layout(t->s, off);
+    void* m = ftruncate(fd, (off_t) z) == 0 ? mmap(NULL, z, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    bool ok = m != MAP_FAILED;
+    if (ok) {
+        frozen f = {(long*) ((char*) m + off[0]), (unsigned*) ((char*) m + off[1]), (unsigned long*) ((char*) m + off[2]), 0, 0, m, z};
+        tree_freeze_into(t, &f);
+        snapshot_header h = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, SNAPSHOT_ORDER, f.n, f.s, z, 0, {0}};
+        h.sum = _snapshot_sum(0xcbf29ce484222325ULL, (char*) m + off[0], z - off[0]);
+        memcpy(m, &h, sizeof(h));
+        ok = msync(m, z, MS_SYNC) == 0;
+        munmap(m, z);
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0 && snapshot_sync_dir(path);
+    if (!ok) {
+        int e = errno;
+        unlink(tmp);
+        errno = e;
+    }
+    free(tmp);
+    return ok;
+}
+
+frozen* tree_open_mmap(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snapshot_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t z = (size_t) st.st_size;
+    void* m = mmap(NULL, z, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return NULL;
+
+    const snapshot_header* h = m;
+    size_t off[3];
+    bool ok = memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) == 0
+        && h->version == SNAPSHOT_VERSION
+        && h->order == SNAPSHOT_ORDER
+        && h->z == z
+        && h->n < z
+        && _snapshot_layout(h->n, off) == z;
+    if (!ok) {
+        munmap(m, z);
+        errno = EINVAL;
+        return NULL;
+    }
+    frozen* f = malloc(sizeof(frozen));
+    Assert(f != NULL, __func__, "malloc error");
+    f->k = (long*) ((char*) m + off[0]);
+    f->c = (unsigned*) ((char*) m + off[1]);
+    f->w = (unsigned long*) ((char*) m + off[2]);
+    f->n = h->n;
+    f->s = h->s;
+    f->m = m;
+    f->z = z;
+    return f;
+}
+
+frozen* tree_open_mmap_verified(const char* path) {
+    frozen* f = tree_open_mmap(path);
+    if (f == NULL) return NULL;
+    size_t o = sizeof(snapshot_header);
+    if (_snapshot_sum(0xcbf29ce484222325ULL, (char*) f->m + o, f->z - o) != ((snapshot_header*) f->m)->sum) {
+        frozen_free(f);
+        errno = EINVAL;
+        return NULL;
+    }
+    return f;
+}
+
+ltree* ltree_open(const char* path, unsigned flags) {
+    frozen* f = tree_open_mmap(path);
+    if (f == NULL) return NULL;
+    ltree* l = malloc(sizeof(ltree));
+    Assert(l != NULL, __func__, "malloc error");
+    l->f = f;
+    l->t = NULL;
+    l->flags = flags;
+    return l;
+}
+
+unsigned ltree_search(ltree* l, long d) {
+    if (l->t == NULL) return frozen_count(l->f, d);
+    tree_node* n = tree_search(l->t, d);
+    return n != NULL ? n->c : 0;
+}
+
+bool ltree_insert(ltree* l, long d) {
+    tree* t = ltree_tree(l);
+    if (t == NULL) return false;
+    tree_insert(t, d);
+    return true;
+}
+
+bool ltree_remove(ltree* l, long d) {
+    // a miss needs no thaw
+    if (l->t == NULL && frozen_search(l->f, d) == 0) return false;
+    tree* t = ltree_tree(l);
+    return t != NULL && tree_remove(t, d);
+}
+
+unsigned long ltree_size(ltree* l) {
+    return l->t != NULL ? tree_size(l->t) : l->f->n;
+}
+
+tree* ltree_tree(ltree* l) {
+    if (l->t == NULL) {
+        l->t = frozen_thaw(l->f, l->flags);
+        if (l->t == NULL) return NULL;
+        frozen_free(l->f);
+        l->f = NULL;
+    }
+    return l->t;
+}
+
+void ltree_free(ltree* l) {
+    if (l->t != NULL) _tree_free(l->t);
+    else frozen_free(l->f);
+    free(l);
+}
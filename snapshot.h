@@ -0,0 +1,111 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tree.h"
+#include "frozen.h"
+
+#ifndef TREE_SNAPSHOT_H
+#define TREE_SNAPSHOT_H
+
+/*
+    on disk snapshots.  the file is a 64 byte header and then the
+    frozen arrays (k, c and w, each from slot 0 and padded to 64
+    bytes) exactly as tree_freeze lays them out in memory, so a
+    mapped file is searched in place with the frozen_* calls and
+    nothing is read until it's touched.  native byte order, which
+    the header records along with a version and a checksum of
+    everything after it.  the checksum costs a read of the whole
+    file, so only tree_open_mmap_verified checks it
+*/
+#define SNAPSHOT_MAGIC "AVLSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ORDER 0x01020304U
+
+typedef struct snapshot_header snapshot_header;
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t order; // SNAPSHOT_ORDER as the writer saw it
+    uint64_t n; // distinct keys
+    uint64_t s; // total count
+    uint64_t z; // file length
+    uint64_t sum; // checksum of the rest of the file
+    uint8_t pad[16];
+};
+
+/*
+    write t to path, by way of path.tmp and a rename, so a crash
+    leaves the old file or the new one.  t is frozen straight into
+    a mapping of the file, so the only copy is the page cache's.
+    returns false, with errno set, if it couldn't
+*/
+bool tree_save(tree* t, const char* path);
+
+/*
+    fsync the directory holding path, so a rename into it lasts
+*/
+bool snapshot_sync_dir(const char* path);
+
+/*
+    map a snapshot read only, after checking its header, in O(1).
+    NULL, with errno set, if it can't be opened or the header
+    isn't good.  damage past the header isn't seen, reads of it
+    may get wrong answers but stay in the file.  frozen_free
+    unmaps it
+*/
+frozen* tree_open_mmap(const char* path);
+
+/*
+    tree_open_mmap, and then check the sum of the whole file
+*/
+frozen* tree_open_mmap_verified(const char* path);
+
+/*
+    a lazily thawed snapshot: reads are served from the mapped
+    file until the first write, which thaws it into a tree (with
+    the flags given to ltree_open) and unmaps the file
+*/
+typedef struct ltree ltree;
+struct ltree {
+    frozen* f; // the mapped snapshot, until thawed
+    tree* t; // the tree, once thawed
+    unsigned flags;
+};
+
+/*
+    NULL if path isn't a good snapshot, by its header as for
+    tree_open_mmap
+*/
+ltree* ltree_open(const char* path, unsigned flags);
+
+/*
+    the count of d, 0 if absent
+*/
+unsigned ltree_search(ltree* l, long d);
+
+/*
+    insert d, false if the thaw it needs finds the file damaged
+    (see frozen_thaw), which leaves l still mapped and unchanged
+*/
+bool ltree_insert(ltree* l, long d);
+
+/*
+    remove one instance of d, true if there was one.  false too,
+    with errno EINVAL, if the thaw finds the file damaged
+*/
+bool ltree_remove(ltree* l, long d);
+
+/*
+    the number of distinct keys
+*/
+unsigned long ltree_size(ltree* l);
+
+/*
+    the mutable tree, thawing it now if need be, NULL as for
+    ltree_insert.  it still belongs to l
+*/
+tree* ltree_tree(ltree* l);
+
+void ltree_free(ltree* l);
+
+#endif //TREE_SNAPSHOT_H
@@ -8,18 +8,204 @@
 #define STATIC static
 #endif
 
-// comments in tree.c
-#ifdef _UNIT_TEST
-STATIC tree_node* _get_root(tree* t);
-STATIC tree_node* _up_to_root(tree_node* n);
+/*
+    sorted input for _build_sorted: keys, optional counts,
+    the next index to take and the length
+*/
+typedef struct sorted_run sorted_run;
+struct sorted_run {
+    const long* k;
+    const unsigned* c;
+    size_t i;
+    size_t n;
+};
+
+/*
+    the source for tree_build_next, and whether it has held up
+*/
+typedef struct build_next build_next;
+struct build_next {
+    bool (*next)(long* d, unsigned* c, void* arg);
+    void* arg;
+    bool ok;
+    bool any; // a key has been taken, last is good
+    long last;
+};
+
+/*
+    node of a TREE_AUGMENTED tree, the plain node first so the
+    rest of the tree code can't tell the difference
+*/
+typedef struct tree_anode tree_anode;
+struct tree_anode {
+    tree_node n;
+    unsigned long s; // distinct values in the subtree
+    unsigned long w; // weight: total count of values in the subtree
+};
+
+/*
+    a rank wanted by tree_quantiles, and where its answer goes
+*/
+typedef struct rank_want rank_want;
+struct rank_want {
+    unsigned long k;
+    size_t i;
+};
+
+/*
+    a sorted, folded batch entry
+*/
+typedef struct key_count key_count;
+struct key_count {
+    long d;
+    unsigned c;
+};
+
+/*
+    batches of at least 1 / TREE_BATCH_MERGE_RATIO of the
+    tree's size are merged and rebuilt rather than applied
+    key by key
+*/
+#define TREE_BATCH_MERGE_RATIO 8
+
+/*
+    a set operation on two subtrees, which forks the top levels
+    of big ones onto threads.  k counts, for union the values in
+    both, for intersection the values kept and for difference
+    the values dropped, so the size of the result is known
+    without a walk
+*/
+enum { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+
+typedef struct set_op set_op;
+struct set_op {
+    tree* t; // for the flags
+    int op;
+    tree_node* a;
+    int ha;
+    tree_node* b;
+    int hb;
+    int threads; // that this op may use, counting its own
+    tree_node* r; // result
+    int h;
+    unsigned long k;
+};
+
+/*
+    set operations fork when both subtrees are at least this tall
+*/
+#define TREE_SET_FORK_HEIGHT 12
+
+/*
+    tree_build sorts with a sample sort: the input is cut into a
+    chunk per thread, each chunk counted into then scattered over
+    a bucket per thread by splitter value, and each bucket sorted
+    and its repeats folded.  one of these per thread
+*/
+typedef struct build_sort build_sort;
+struct build_sort {
+    const long* d; // the chunk
+    size_t n;
+    const long* s; // nb - 1 ascending splitters
+    int nb;
+    size_t* at; // the chunk's count in each bucket, then where its next goes
+    long* k; // the buckets, end to end
+    unsigned* c; // the folded counts, alongside
+    size_t lo; // this thread's bucket
+    size_t hi;
+    size_t m; // distinct values in the bucket once folded
+    bool dedup;
+};
+
+/*
+    a subtree of tree_build's, over the sorted distinct values
+    in [lo, hi)
+*/
+typedef struct build_job build_job;
+struct build_job {
+    tree* t;
+    const long* k;
+    const unsigned* c;
+    tree_node** nodes; // allocated up front for slab trees, else NULL
+    size_t lo;
+    size_t hi;
+    int threads;
+    tree_node* r;
+    int h;
+};
+
+/*
+    tree_build hands subtrees of at least this many values to
+    another thread, and sorts on one thread below 8 times it
+*/
+#define TREE_BUILD_FORK (1UL << 14)
+
+/*
+    comments in tree.c.  tree.c defines TREE_SOURCE to see its own
+    prototypes in every build, tests see them under _UNIT_TEST
+*/
+#if defined(_UNIT_TEST) || defined(TREE_SOURCE)
+tree_node* _get_root(tree* t);
+STATIC tree_node* _node_new(tree* t, long d);
+STATIC void _node_free(tree* t, tree_node* n);
+STATIC size_t _node_size(tree* t);
 
-STATIC tree_node* _insert_node(tree_node* n, tree_node* c);
+tree_node* _insert_node(tree_node* n, tree_node* c);
+STATIC void _insert_count(tree* t, long d, unsigned c);
+STATIC tree_node* _insert_descend(tree_node* n, long d);
+STATIC tree_node* _insert_attach(tree_node* n, tree_node* c);
 
 STATIC tree_node* _retrace_insert(tree_node* n);
 STATIC void _update_bf_insert(tree_node* p, tree_node* c);
 
 STATIC tree_node* _rebalance(tree_node* n);
 
+STATIC tree_node* _build_sorted(tree* t, sorted_run* in, unsigned long m, int* h);
+STATIC tree_node* _build_next(tree* t, build_next* in, unsigned long m, int* h);
+STATIC tree_node* _build_list(tree* t, tree_node** l, unsigned long m, int* h);
+STATIC tree_node* _vine(tree_node* n);
+
+STATIC void _build_run(void* (*f)(void*), void* jobs, size_t z, int n);
+STATIC int _build_bucket(const long* s, int nb, long v);
+STATIC void* _build_count(void* arg);
+STATIC void* _build_scatter(void* arg);
+STATIC void* _build_fold(void* arg);
+STATIC void* _build_range(void* arg);
+
+STATIC int _height(tree_node* n);
+STATIC void _join_hang(tree_node* k, tree_node* l, int hl, tree_node* r, int hr);
+STATIC tree_node* _join(tree* t, tree_node* l, int hl, tree_node* k, tree_node* r, int hr, int* h);
+STATIC bool _join_check(tree* l, tree* r);
+
+STATIC tree* _set_trees(tree* a, tree* b, int op, int threads);
+STATIC void _set_op(set_op* o);
+STATIC void* _set_op_thread(void* arg);
+STATIC tree_node* _split(tree* t, tree_node* n, int h, long d, tree_node** l, int* hl, tree_node** r, int* hr);
+STATIC tree_node* _join_concat(tree* t, tree_node* l, int hl, tree_node* r, int hr, int* h);
+STATIC unsigned long _split_size(tree* t, tree_node* a, tree_node* b);
+
+STATIC int _long_cmp(const void* a, const void* b);
+STATIC key_count* _batch_sort(const long* d, size_t n, unsigned long* m);
+STATIC bool _batch_merge(tree* t, unsigned long m);
+STATIC void _merge_insert(tree* t, key_count* b, unsigned long m);
+STATIC unsigned long _merge_remove(tree* t, key_count* b, unsigned long m);
+STATIC void _remove_node(tree* t, tree_node* n);
+
+STATIC tree_node* _leftmost(tree_node* n);
+STATIC tree_node* _rightmost(tree_node* n);
+STATIC tree_node* _successor(tree_node* n);
+STATIC tree_node* _predecessor(tree_node* n);
+
+STATIC void _aug_pull(tree_node* n);
+STATIC void _aug_fix(tree* t, tree_node* n);
+STATIC tree_node* _aug_insert_attach(tree_node* n, tree_node* c);
+STATIC void _aug_add(tree* t, tree_node* n, long dc);
+STATIC unsigned long _rank(tree* t, long d, bool distinct);
+STATIC tree_node* _select(tree* t, unsigned long k, bool distinct);
+STATIC unsigned long _quantile_rank(double q, unsigned long w);
+STATIC int _rank_want_cmp(const void* a, const void* b);
+STATIC void _select_many(tree_node* n, rank_want* wants, size_t m, unsigned long off, tree_node** out);
+
 STATIC tree_node* _retrace_remove(tree_node* n);
 
 STATIC void _remove_splice(tree_node* n, tree_node* c, tree_node* r);
@@ -32,6 +218,28 @@ STATIC tree_node* _right_right(tree_node* X);
 STATIC tree_node* _right_left(tree_node* X);
 STATIC tree_node* _left_left(tree_node* X);
 STATIC tree_node* _left_right(tree_node* X);
+#endif // _UNIT_TEST || TREE_SOURCE
+
+#ifdef _UNIT_TEST
+// btree.c
+typedef struct btree btree;
+STATIC unsigned long _btree_check(btree* b);
+
+// compact.c
+typedef struct ctree ctree;
+STATIC int _ctree_check(ctree* t);
+
+// pathtree.c
+typedef struct ptree ptree;
+STATIC int _ptree_check(ptree* t);
+
+// rcu.c
+typedef struct rtree rtree;
+STATIC int _rtree_check(rtree* t);
+
+// cow.c
+typedef struct vtree vtree;
+STATIC int _vtree_check(vtree* t);
 #endif // _UNIT_TEST
 
 #endif //TREE_STATIC_H
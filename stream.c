@@ -0,0 +1,169 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../log/log.h"
+#include "release.h"
+#include "../tree-node/tree_node.h"
+
+#include "tree.h"
+#include "stream.h"
+
+// the most a pair can take: a 64 bit delta and a 32 bit count
+#define STREAM_PAIR_MAX (10 + 5)
+
+/*
+    a chunk being read: its bytes, how far in, and the pairs left
+*/
+typedef struct stream_in stream_in;
+struct stream_in {
+    FILE* in;
+    unsigned char* b;
+    size_t i;
+    size_t z;
+    unsigned long n;
+    long last;
+};
+
+static size_t _varint_put(unsigned char* b, unsigned long v) {
+    size_t i = 0;
+    while (v >= 0x80) {
+        b[i++] = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    b[i++] = (unsigned char) v;
+    return i;
+}
+
+/*
+    a varint from b[*i..z), false if it runs off the end or is
+    too long
+*/
+static bool _varint_get(const unsigned char* b, size_t* i, size_t z, unsigned long* v) {
+    unsigned long x = 0;
+    for (int s = 0; s < 64; s += 7) {
+        if (*i >= z) return false;
+        unsigned char c = b[(*i)++];
+        // the tenth byte has room for one bit
+        if (s == 63 && (c & 0x7e)) return false;
+        x |= (unsigned long) (c & 0x7f) << s;
+        if (!(c & 0x80)) {
+            *v = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    _varint_get, from the file
+*/
+static bool _varint_read(FILE* in, unsigned long* v) {
+    unsigned char b[10];
+    size_t z = 0;
+    int c;
+    do {
+        if (z == sizeof(b) || (c = fgetc(in)) == EOF) return false;
+        b[z++] = (unsigned char) c;
+    } while (c & 0x80);
+    size_t i = 0;
+    return _varint_get(b, &i, z, v);
+}
+
+static bool _varint_write(FILE* o, unsigned long v) {
+    unsigned char b[10];
+    size_t z = _varint_put(b, v);
+    return fwrite(b, 1, z, o) == z;
+}
+
+static unsigned long _zigzag(long d) {
+    return ((unsigned long) d << 1) ^ (unsigned long) (d >> 63);
+}
+
+static long _unzigzag(unsigned long v) {
+    return (long) (v >> 1) ^ -(long) (v & 1);
+}
+
+static bool _stream_flush(FILE* o, const unsigned char* b, size_t z, unsigned long n) {
+    return _varint_write(o, n) && _varint_write(o, z) && fwrite(b, 1, z, o) == z;
+}
+
+bool tree_stream_write(tree* t, FILE* o) {
+    unsigned char* b = malloc(STREAM_CHUNK);
+    Assert(b != NULL, __func__, "malloc error");
+    bool ok = fwrite(STREAM_MAGIC, 1, 7, o) == 7 && fputc(STREAM_VERSION, o) != EOF && _varint_write(o, tree_size(t));
+    size_t z = 0;
+    unsigned long n = 0;
+    long last = 0;
+    tree_cursor c;
+    for (tree_node* x = tree_cursor_first(&c, t); x != NULL && ok; x = tree_cursor_next(&c)) {
+        if (STREAM_CHUNK - z < STREAM_PAIR_MAX) {
+            ok = _stream_flush(o, b, z, n);
+            z = 0;
+            n = 0;
+        }
+        if (n == 0) z += _varint_put(b + z, _zigzag(x->d));
+        else z += _varint_put(b + z, (unsigned long) x->d - (unsigned long) last);
+        z += _varint_put(b + z, x->c - 1);
+        last = x->d;
+        n++;
+    }
+    if (n > 0) ok = ok && _stream_flush(o, b, z, n);
+    ok = ok && _varint_write(o, 0);
+    free(b);
+    return ok;
+}
+
+/*
+    the next chunk's header and bytes, false at the end (or if
+    it's bad)
+*/
+static bool _stream_chunk(stream_in* s) {
+    unsigned long n, z;
+    if (!_varint_read(s->in, &n) || n == 0) return false;
+    if (!_varint_read(s->in, &z) || z > STREAM_CHUNK) return false;
+    if (fread(s->b, 1, z, s->in) != z) return false;
+    s->n = n;
+    s->i = 0;
+    s->z = z;
+    return true;
+}
+
+/*
+    the next pair for tree_build_next.  a chunk has to be used up
+    exactly before the next one starts
+*/
+static bool _stream_next(long* d, unsigned* c, void* arg) {
+    stream_in* s = arg;
+    bool first = false;
+    if (s->n == 0) {
+        if (s->i != s->z || !_stream_chunk(s)) return false;
+        first = true;
+    }
+    unsigned long k, v;
+    if (!_varint_get(s->b, &s->i, s->z, &k) || !_varint_get(s->b, &s->i, s->z, &v)) return false;
+    if (v >= UINT_MAX) return false;
+    *d = first ? _unzigzag(k) : (long) ((unsigned long) s->last + k);
+    *c = (unsigned) v + 1;
+    s->last = *d;
+    s->n--;
+    return true;
+}
+
+tree* tree_stream_read(FILE* in, unsigned flags) {
+    char magic[8];
+    unsigned long m;
+    if (fread(magic, 1, 8, in) != 8 || memcmp(magic, STREAM_MAGIC, 7) != 0) return NULL;
+    if (magic[7] != STREAM_VERSION || !_varint_read(in, &m)) return NULL;
+    stream_in s = {in, malloc(STREAM_CHUNK), 0, 0, 0, 0};
+    Assert(s.b != NULL, __func__, "malloc error");
+    tree* t = tree_build_next(m, _stream_next, &s, flags);
+    // and nothing after the last pair but the end
+    unsigned long end;
+    if (t != NULL && (s.n != 0 || s.i != s.z || !_varint_read(in, &end) || end != 0)) {
+        _tree_free(t);
+        t = NULL;
+    }
+    free(s.b);
+    return t;
+}
@@ -0,0 +1,38 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "tree.h"
+
+#ifndef TREE_STREAM_H
+#define TREE_STREAM_H
+
+/*
+    streamed trees, for pipes and sockets.  the stream is
+
+        "AVLSTRM", a version byte, varint m (distinct keys)
+        chunks: varint n (pairs), varint length, then n pairs
+        a chunk with n = 0 to end it
+
+    the pairs are in key order, each key a varint delta from the
+    last (the first in a chunk is zigzagged on its own, so chunks
+    stand alone) and then varint count - 1.  chunks are at most
+    STREAM_CHUNK bytes, which is all either end ever buffers
+*/
+#define STREAM_MAGIC "AVLSTRM"
+#define STREAM_VERSION 1
+#define STREAM_CHUNK (64 * 1024)
+
+/*
+    write t to o a chunk at a time, straight off of a cursor.
+    false if a write failed
+*/
+bool tree_stream_write(tree* t, FILE* o);
+
+/*
+    read a stream from in into a new tree with the given TREE_*
+    flags, building it as the pairs arrive, in O(n).  NULL if the
+    stream is short or malformed
+*/
+tree* tree_stream_read(FILE* in, unsigned flags);
+
+#endif //TREE_STREAM_H
@@ -1,14 +1,28 @@
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "../log/log.h"
 #include "../queue/queue.h"
 #include "../tree-node/tree_node.h"
 
 #include "tree.h"
+#include "frozen.h"
+#include "btree.h"
+#include "compact.h"
+#include "pathtree.h"
+#include "rcu.h"
+#include "cow.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "wal.h"
 #include "test-support.h"
 
 void _check_tree(tree* t) {
@@ -337,6 +351,48 @@ void test_lopsided() {
     tree_node_free_recurse(y);
 }
 
+void test_left_right_balance() {
+    printf("left right balance factor test\n");
+    tree_node* n0 = tree_node_new(0);
+    tree_node* n1 = tree_node_new(1);
+    tree_node* n2 = tree_node_new(2);
+    tree_node* n3 = tree_node_new(3);
+    tree_node* n5 = tree_node_new(5);
+    tree_node* n6 = tree_node_new(6);
+    n5->l = n1;
+    n1->p = n5;
+    n5->r = n6;
+    n6->p = n5;
+    n1->l = n0;
+    n0->p = n1;
+    n1->r = n3;
+    n3->p = n1;
+    n3->l = n2;
+    n2->p = n3;
+    n3->b = -1;
+    n1->b = 1;
+    n5->b = -2;
+    tree_node* x = _left_right(n5);
+    assert(x == n3 && x->b == 0);
+    assert(x->l == n1 && n1->b == 0 && n1->l == n0 && n1->r == n2);
+    assert(x->r == n5 && n5->b == 1 && n5->l == NULL && n5->r == n6);
+    tree_node_check(x);
+    tree_node_free_recurse(x);
+
+    // and the mirror, Y right heavy
+    tree* t = tree_new();
+    long nums[] = {5, 1, 6, 0, 3, 4};
+    for (int i = 0; i < sizeof(nums) / sizeof(long); i++) {
+        tree_insert(t, nums[i]);
+    }
+    x = _get_root(t);
+    assert(x->d == 3 && x->b == 0);
+    assert(x->l->d == 1 && x->l->b == -1);
+    assert(x->r->d == 5 && x->r->b == 0);
+    tree_node_check(x);
+    _tree_free(t);
+}
+
 void test_insert_correctness() {
     printf("insertion correctness test\n");
     tree* t = tree_new();
@@ -437,6 +493,84 @@ void test__remove_right_no_left() {
     _tree_free(t);
 }
 
+/*
+    removes that move a child up have to re-parent it, and a
+    replacement at the root can still need a rotation
+*/
+void test_remove_relink() {
+    printf("testing re-parenting on remove\n");
+    tree_node* n1 = tree_node_new(1);
+    tree_node* n2 = tree_node_new(2);
+    tree_node* n3 = tree_node_new(3);
+    n2->l = n1;
+    n1->p = n2;
+    n2->r = n3;
+    n3->p = n2;
+    // 3 takes over 1, and no rotation fixes up its parent
+    tree_node* x = _remove_right_no_left(n2);
+    free(n2);
+    assert(x == n3 && x->p == NULL && x->b == -1);
+    assert(x->l == n1 && n1->p == n3);
+    tree_node_check(x);
+    tree_node_free_recurse(x);
+
+    tree_node* n0 = tree_node_new(0);
+    n1 = tree_node_new(1);
+    n2 = tree_node_new(2);
+    n3 = tree_node_new(3);
+    n2->l = n1;
+    n1->p = n2;
+    n1->l = n0;
+    n0->p = n1;
+    n2->r = n3;
+    n3->p = n2;
+    n1->b = -1;
+    n2->b = -1;
+    // 3 takes over 1, two high, so the root comes out at -2
+    x = _remove_right_no_left(n2);
+    free(n2);
+    assert(x == n1 && x->p == NULL && x->b == 0);
+    assert(x->l == n0 && n0->p == n1 && x->r == n3 && n3->p == n1 && n3->b == 0);
+    tree_node_check(x);
+    tree_node_free_recurse(x);
+
+    tree_node* n4 = tree_node_new(4);
+    tree_node* n5 = tree_node_new(5);
+    tree_node* n6 = tree_node_new(6);
+    tree_node* n7 = tree_node_new(7);
+    n0 = tree_node_new(0);
+    n1 = tree_node_new(1);
+    n2 = tree_node_new(2);
+    n3 = tree_node_new(3);
+    n2->l = n1;
+    n1->p = n2;
+    n1->l = n0;
+    n0->p = n1;
+    n2->r = n5;
+    n5->p = n2;
+    n5->l = n3;
+    n3->p = n5;
+    n3->r = n4;
+    n4->p = n3;
+    n5->r = n6;
+    n6->p = n5;
+    n6->r = n7;
+    n7->p = n6;
+    n1->b = -1;
+    n2->b = 1;
+    n3->b = 1;
+    n6->b = 1;
+    tree_node_check(n2);
+    // 3 replaces 2, and its right child 4 goes up to 5
+    _remove_complex(n2);
+    free(n2);
+    assert(n3->p == NULL && n3->l == n1 && n1->p == n3 && n3->r == n5 && n5->p == n3);
+    assert(n5->l == n4 && n4->p == n5 && n5->b == 1);
+    check_bf(n3);
+    tree_node_check(n3);
+    tree_node_free_recurse(n3);
+}
+
 struct node_con {
     tree_node* root;
     tree_node* removal;
@@ -537,6 +671,1213 @@ void test_tree_inorder() {
     free(q);
 }
 
+void test_slab() {
+    printf("testing slab allocated tree\n");
+    tree* t = tree_new_flags(TREE_SLAB);
+    for (long i = 0; i <= 5000; i++) {
+        tree_insert(t, i);
+    }
+    tree_node_check(_get_root(t));
+    tree_node* n = tree_search(t, 2500);
+    assert(tree_remove(t, 2500));
+    assert(!tree_search(t, 2500));
+    // removed node is handed back out first
+    tree_insert(t, 10000);
+    assert(tree_search(t, 10000) == n);
+    for (long i = 0; i <= 5000; i += 2) {
+        assert(tree_remove(t, i) == (i != 2500));
+    }
+    tree_node_check(_get_root(t));
+    assert(tree_size(t) == 2501);
+    for (long i = 1; i <= 5000; i += 2) {
+        assert(tree_search(t, i)->d == i);
+    }
+    _tree_free(t);
+}
+
+void test_build_sorted() {
+    printf("testing tree_build_sorted\n");
+    for (size_t n = 0; n <= 300; n++) {
+        // one spare, so n = 0 isn't a zero length array
+        long keys[n + 1];
+        for (size_t i = 0; i < n; i++) {
+            keys[i] = (long) i;
+        }
+        tree* t = tree_build_sorted(keys, NULL, n);
+        assert(tree_size(t) == n);
+        tree_node_check(_get_root(t));
+        check_bf(_get_root(t));
+        for (size_t i = 0; i < n; i++) {
+            assert(tree_search(t, keys[i])->c == 1);
+        }
+        // and it's an ordinary tree afterwards
+        tree_insert(t, -1);
+        tree_insert(t, (long) n);
+        assert(tree_remove(t, 0) || n == 0);
+        tree_node_check(_get_root(t));
+        _tree_free(t);
+    }
+
+    long keys[] = {LONG_MIN, 1, 1, 1, 2, 5, 5, LONG_MAX};
+    unsigned counts[] = {1, 2, 1, 1, 4, 1, 1, 3};
+    tree* t = tree_build_sorted(keys, counts, 8);
+    assert(tree_size(t) == 5);
+    assert(tree_search(t, LONG_MIN)->c == 1);
+    assert(tree_search(t, 1)->c == 4);
+    assert(tree_search(t, 2)->c == 4);
+    assert(tree_search(t, 5)->c == 2);
+    assert(tree_search(t, LONG_MAX)->c == 3);
+    assert(tree_search(t, 3) == NULL);
+    tree_node_check(_get_root(t));
+    _tree_free(t);
+
+    t = tree_build_sorted(keys, NULL, 8);
+    assert(tree_size(t) == 5);
+    assert(tree_search(t, 1)->c == 3);
+    _tree_free(t);
+}
+
+void test_batch() {
+    printf("testing batch insert and remove\n");
+    tree* t = tree_new();
+    // big batch into an empty tree, merged
+    long b[3000];
+    for (int i = 0; i < 3000; i++) {
+        b[i] = (i * 7919) % 1000;
+    }
+    tree_insert_batch(t, b, 3000);
+    assert(tree_size(t) == 1000);
+    for (long i = 0; i < 1000; i++) {
+        assert(tree_search(t, i)->c == 3);
+    }
+    tree_node_check(_get_root(t));
+    check_bf(_get_root(t));
+
+    // small batch, key by key
+    long s[] = {5000, 3, -1, 5000};
+    tree_insert_batch(t, s, 4);
+    assert(tree_size(t) == 1002);
+    assert(tree_search(t, 5000)->c == 2);
+    assert(tree_search(t, 3)->c == 4);
+    assert(tree_remove_batch(t, s, 4) == 4);
+    assert(tree_size(t) == 1000);
+    assert(tree_search(t, 5000) == NULL);
+    assert(tree_search(t, -1) == NULL);
+    assert(tree_search(t, 3)->c == 3);
+    tree_node_check(_get_root(t));
+
+    // big remove, including values that aren't there
+    for (int i = 0; i < 3000; i++) {
+        b[i] = i % 1500;
+    }
+    assert(tree_remove_batch(t, b, 3000) == 2000);
+    assert(tree_size(t) == 1000);
+    for (long i = 0; i < 1000; i++) {
+        assert(tree_search(t, i)->c == 1);
+    }
+    tree_node_check(_get_root(t));
+    check_bf(_get_root(t));
+    assert(tree_remove_batch(t, b, 3000) == 1000);
+    assert(tree_size(t) == 0);
+    assert(_get_root(t) == NULL);
+    _tree_free(t);
+}
+
+void test_cursor() {
+    printf("testing tree_cursor\n");
+    tree_cursor c;
+    tree* t = tree_new();
+    assert(tree_cursor_first(&c, t) == NULL);
+    assert(tree_cursor_next(&c) == NULL);
+    assert(tree_cursor_seek(&c, t, 0) == NULL);
+    for (long i = 0; i <= 1000; i++) {
+        tree_insert(t, i * 2);
+    }
+    // removals reshape the tree, the parents have to stay right
+    for (long i = 0; i <= 1000; i += 3) {
+        assert(tree_remove(t, i * 2));
+    }
+    long expect = 2;
+    long seen = 0;
+    for (tree_node* n = tree_cursor_first(&c, t); n != NULL; n = tree_cursor_next(&c)) {
+        assert(n->d == expect);
+        expect += 2;
+        if ((expect / 2) % 3 == 0) expect += 2;
+        seen++;
+    }
+    assert(seen == tree_size(t));
+    seen = 0;
+    for (tree_node* n = tree_cursor_last(&c, t); n != NULL; n = tree_cursor_prev(&c)) {
+        seen++;
+    }
+    assert(seen == tree_size(t));
+
+    assert(tree_cursor_seek(&c, t, 10)->d == 10);
+    assert(tree_cursor_seek(&c, t, 11)->d == 14); // 12 was removed
+    assert(tree_cursor_next(&c)->d == 16);
+    assert(tree_cursor_prev(&c)->d == 14);
+    assert(tree_cursor_prev(&c)->d == 10);
+    assert(tree_cursor_seek(&c, t, -5)->d == 2);
+    assert(tree_cursor_seek(&c, t, 1999)->d == 2000);
+    assert(tree_cursor_seek(&c, t, 2001) == NULL);
+    _tree_free(t);
+}
+
+struct range_sum {
+    long sum;
+    long stop; // stop once this value is seen
+};
+
+bool range_add(tree_node* n, void* arg) {
+    struct range_sum* r = arg;
+    r->sum += n->d;
+    return n->d != r->stop;
+}
+
+void test_range() {
+    printf("testing range queries\n");
+    tree* t = tree_new();
+    assert(tree_lower_bound(t, 0) == NULL);
+    assert(tree_floor(t, 0) == NULL);
+    for (long i = 0; i < 100; i++) {
+        tree_insert(t, i * 10);
+    }
+    assert(tree_lower_bound(t, 50)->d == 50);
+    assert(tree_lower_bound(t, 51)->d == 60);
+    assert(tree_lower_bound(t, -1)->d == 0);
+    assert(tree_lower_bound(t, 991) == NULL);
+    assert(tree_upper_bound(t, 50)->d == 60);
+    assert(tree_upper_bound(t, 49)->d == 50);
+    assert(tree_upper_bound(t, 990) == NULL);
+    assert(tree_floor(t, 55)->d == 50);
+    assert(tree_floor(t, 50)->d == 50);
+    assert(tree_floor(t, -1) == NULL);
+    assert(tree_floor(t, LONG_MAX)->d == 990);
+    assert(tree_ceiling(t, 55)->d == 60);
+
+    struct range_sum r = {0, -1};
+    assert(tree_range(t, 100, 200, range_add, &r) == 10);
+    assert(r.sum == 1450);
+    r.sum = 0;
+    assert(tree_range(t, 95, 101, range_add, &r) == 1);
+    assert(r.sum == 100);
+    r.sum = 0;
+    assert(tree_range(t, 200, 200, range_add, &r) == 0);
+    r.stop = 120;
+    assert(tree_range(t, LONG_MIN, LONG_MAX, range_add, &r) == 13);
+    assert(r.sum == 780);
+    _tree_free(t);
+}
+
+/*
+    check the subtree aggregates of an augmented tree, returns
+    the weight of the subtree
+*/
+unsigned long check_aug(tree_node* n, unsigned long* s) {
+    if (n == NULL) {
+        *s = 0;
+        return 0;
+    }
+    unsigned long ls, rs;
+    unsigned long w = check_aug(n->l, &ls) + check_aug(n->r, &rs) + n->c;
+    *s = ls + rs + 1;
+    assert(((tree_anode*) n)->s == *s);
+    assert(((tree_anode*) n)->w == w);
+    return w;
+}
+
+void test_order_statistics() {
+    printf("testing rank and select\n");
+    unsigned f[] = {TREE_AUGMENTED, TREE_AUGMENTED | TREE_SLAB};
+    for (int i = 0; i < 2; i++) {
+        tree* t = tree_new_flags(f[i]);
+        unsigned long s;
+        assert(tree_rank(t, 0) == 0);
+        assert(tree_select(t, 0) == NULL);
+        // value v is inserted v % 3 + 1 times
+        for (long v = 0; v < 600; v++) {
+            for (long c = 0; c <= v % 3; c++) {
+                tree_insert(t, v);
+            }
+        }
+        assert(check_aug(_get_root(t), &s) == 1200);
+        assert(s == 600);
+        tree_node_check(_get_root(t));
+        assert(tree_rank(t, 0) == 0);
+        assert(tree_rank(t, 3) == 6);
+        assert(tree_rank(t, 600) == 1200);
+        assert(tree_rank_distinct(t, 3) == 3);
+        assert(tree_select(t, 0)->d == 0);
+        assert(tree_select(t, 1)->d == 1);
+        assert(tree_select(t, 2)->d == 1);
+        assert(tree_select(t, 6)->d == 3);
+        assert(tree_select(t, 1199)->d == 599);
+        assert(tree_select(t, 1200) == NULL);
+        assert(tree_select_distinct(t, 42)->d == 42);
+        assert(tree_count_range(t, 3, 6) == 6);
+        assert(tree_count_range(t, 6, 3) == 0);
+
+        // removals, both of counts and of whole nodes
+        for (long v = 0; v < 600; v += 2) {
+            assert(tree_remove(t, v));
+        }
+        assert(check_aug(_get_root(t), &s) == 900);
+        assert(s == 500);
+        assert(tree_rank(t, 3) == 4);
+
+        long b[300];
+        for (int j = 0; j < 300; j++) {
+            b[j] = j * 2 + 1;
+        }
+        tree_insert_batch(t, b, 300);
+        assert(check_aug(_get_root(t), &s) == 1200);
+        assert(tree_remove_batch(t, b, 2) == 2);
+        assert(check_aug(_get_root(t), &s) == 1198);
+        tree_node_check(_get_root(t));
+        _tree_free(t);
+    }
+
+    long keys[] = {1, 1, 2, 5, 5, 5, 9};
+    tree* t = tree_build_sorted_flags(keys, NULL, 7, TREE_AUGMENTED);
+    unsigned long s;
+    assert(check_aug(_get_root(t), &s) == 7);
+    assert(s == 4);
+    assert(tree_rank(t, 5) == 3);
+    assert(tree_select(t, 5)->d == 5);
+    _tree_free(t);
+}
+
+void test_build() {
+    printf("testing tree_build\n");
+    // big enough to sort in buckets and build on threads
+    size_t n = 300000;
+    long* d = malloc(sizeof(long) * n);
+    for (size_t i = 0; i < n; i++) {
+        d[i] = (long) ((i * 7919) % 100000) - 50000;
+    }
+    d[0] = LONG_MIN;
+    d[1] = LONG_MAX;
+    unsigned f[] = {0, TREE_AUGMENTED, TREE_SLAB, TREE_BUILD_DEDUP};
+    for (int i = 0; i < 4; i++) {
+        for (int threads = 1; threads <= 4; threads += 3) {
+            tree* t = tree_build(d, n, f[i], threads);
+            assert(!(t->f & TREE_BUILD_DEDUP));
+            assert(tree_size(t) == 100002);
+            tree_node_check(_get_root(t));
+            check_bf(_get_root(t));
+            unsigned long s;
+            if (f[i] & TREE_AUGMENTED) assert(check_aug(_get_root(t), &s) == n);
+            unsigned c = f[i] & TREE_BUILD_DEDUP ? 1 : 3;
+            assert(tree_search(t, LONG_MIN)->c == 1);
+            assert(tree_search(t, LONG_MAX)->c == 1);
+            // LONG_MIN took one of its places
+            assert(tree_search(t, -50000)->c == (c > 1 ? c - 1 : c));
+            assert(tree_search(t, 0)->c == c);
+            assert(tree_search(t, 49999)->c == c);
+            assert(tree_search(t, 50000) == NULL);
+            tree_insert(t, 50000);
+            assert(tree_remove(t, 0));
+            tree_node_check(_get_root(t));
+            _tree_free(t);
+        }
+    }
+    free(d);
+
+    long few[] = {3, 1, 2, 3};
+    tree* t = tree_build(few, 4, 0, 4);
+    assert(tree_size(t) == 3);
+    assert(tree_search(t, 3)->c == 2);
+    _tree_free(t);
+    t = tree_build(few, 0, 0, 4);
+    assert(tree_size(t) == 0 && _get_root(t) == NULL);
+    _tree_free(t);
+}
+
+/*
+    every value in [lo, hi) is in t v % 3 + 1 times, for even v
+*/
+void check_split(tree* t, long lo, long hi) {
+    unsigned long s;
+    tree_node_check(_get_root(t));
+    if (t->f & TREE_AUGMENTED) check_aug(_get_root(t), &s);
+    unsigned long n = 0;
+    for (long v = lo; v < hi; v++) {
+        tree_node* x = tree_search(t, v);
+        if (v % 2 == 0) {
+            assert(x != NULL && x->c == v % 3 + 1);
+            n++;
+        } else assert(x == NULL);
+    }
+    assert(tree_size(t) == n);
+}
+
+void test_split_join() {
+    printf("testing split and join\n");
+    unsigned f[] = {0, TREE_AUGMENTED};
+    long at[] = {-10, 0, 1, 2, 77, 78, 500, 998, 999, 2000};
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 10; j++) {
+            tree* t = tree_new_flags(f[i]);
+            for (long v = 0; v < 1000; v += 2) {
+                for (long c = 0; c <= v % 3; c++) {
+                    tree_insert(t, v);
+                }
+            }
+            tree* l;
+            tree* r;
+            tree_split(t, at[j], &l, &r);
+            long d = at[j] < 0 ? 0 : at[j] > 1000 ? 1000 : at[j];
+            check_split(l, 0, d);
+            check_split(r, d, 1000);
+            assert(tree_search(l, d) == NULL);
+
+            // glue back together, with and without a key between
+            if (d % 2 == 1) {
+                t = tree_join(l, d, r);
+                assert(tree_search(t, d)->c == 1);
+                assert(tree_size(t) == 501);
+                assert(tree_remove(t, d));
+            } else t = tree_concat(l, r);
+            check_split(t, 0, 1000);
+            _tree_free(t);
+        }
+    }
+
+    // lopsided joins walk down the taller tree
+    tree* l = tree_new();
+    tree* r = tree_new();
+    for (long v = 0; v < 1000; v++) {
+        tree_insert(l, v);
+    }
+    tree_insert(r, 2000);
+    tree* t = tree_join(l, 1500, r);
+    tree_node_check(_get_root(t));
+    assert(tree_size(t) == 1002);
+    t = tree_join(tree_new(), -1, t);
+    tree_node_check(_get_root(t));
+    assert(tree_size(t) == 1003);
+    assert(_leftmost(_get_root(t))->d == -1);
+    _tree_free(t);
+
+    // a slab keeps its nodes, and flags have to match, in release
+    // builds too
+    tree* s = tree_new_flags(TREE_SLAB);
+    tree_insert(s, 1);
+    assert(!tree_split(s, 1, &l, &r));
+    l = tree_new();
+    r = tree_new_flags(TREE_AUGMENTED);
+    assert(tree_join(l, 5, s) == NULL);
+    assert(tree_concat(l, r) == NULL);
+    assert(tree_union(l, r, 1) == NULL);
+    assert(tree_size(s) == 1 && tree_search(s, 1) != NULL);
+    _tree_free(s);
+    _tree_free(l);
+    _tree_free(r);
+}
+
+/*
+    a holds every multiple of 2 below n twice, b every multiple of
+    3 three times
+*/
+void set_trees(unsigned f, long n, tree** a, tree** b) {
+    *a = tree_new_flags(f);
+    *b = tree_new_flags(f);
+    for (long v = 0; v < n; v++) {
+        if (v % 2 == 0) {
+            tree_insert(*a, v);
+            tree_insert(*a, v);
+        }
+        if (v % 3 == 0) {
+            tree_insert(*b, v);
+            tree_insert(*b, v);
+            tree_insert(*b, v);
+        }
+    }
+}
+
+void test_set_ops() {
+    printf("testing union, intersection and difference\n");
+    unsigned f[] = {0, TREE_AUGMENTED};
+    // big enough to fork with more than one thread
+    long n = 30000;
+    unsigned long s;
+    for (int i = 0; i < 2; i++) {
+        for (int threads = 1; threads <= 4; threads += 3) {
+            tree* a;
+            tree* b;
+            set_trees(f[i], n, &a, &b);
+            tree* t = tree_union(a, b, threads);
+            tree_node_check(_get_root(t));
+            if (f[i] & TREE_AUGMENTED) check_aug(_get_root(t), &s);
+            unsigned long m = 0;
+            for (long v = 0; v < n; v++) {
+                unsigned c = (v % 2 == 0 ? 2 : 0) + (v % 3 == 0 ? 3 : 0);
+                tree_node* x = tree_search(t, v);
+                if (c == 0) assert(x == NULL);
+                else assert(x != NULL && x->c == c);
+                m += c > 0;
+            }
+            assert(tree_size(t) == m);
+            _tree_free(t);
+
+            set_trees(f[i], n, &a, &b);
+            t = tree_intersection(a, b, threads);
+            tree_node_check(_get_root(t));
+            if (f[i] & TREE_AUGMENTED) check_aug(_get_root(t), &s);
+            for (long v = 0; v < n; v++) {
+                tree_node* x = tree_search(t, v);
+                if (v % 6 == 0) assert(x != NULL && x->c == 2);
+                else assert(x == NULL);
+            }
+            assert(tree_size(t) == (unsigned long) (n + 5) / 6);
+            _tree_free(t);
+
+            // b's counts are bigger, so the common values go
+            set_trees(f[i], n, &a, &b);
+            t = tree_difference(a, b, threads);
+            tree_node_check(_get_root(t));
+            if (f[i] & TREE_AUGMENTED) check_aug(_get_root(t), &s);
+            m = 0;
+            for (long v = 0; v < n; v++) {
+                tree_node* x = tree_search(t, v);
+                if (v % 2 == 0 && v % 3 != 0) {
+                    assert(x != NULL && x->c == 2);
+                    m++;
+                } else assert(x == NULL);
+            }
+            assert(tree_size(t) == m);
+            _tree_free(t);
+
+            set_trees(f[i], n, &a, &b);
+            t = tree_difference(b, a, threads);
+            assert(tree_search(t, 6)->c == 1);
+            assert(tree_search(t, 3)->c == 3);
+            assert(tree_search(t, 2) == NULL);
+            _tree_free(t);
+        }
+    }
+
+    // with an empty side
+    tree* a = tree_new();
+    tree* b = tree_new();
+    tree_insert(b, 1);
+    tree* t = tree_union(a, b, 1);
+    assert(tree_size(t) == 1);
+    t = tree_intersection(t, tree_new(), 1);
+    assert(tree_size(t) == 0 && _get_root(t) == NULL);
+    _tree_free(t);
+}
+
+void test_quantiles() {
+    printf("testing quantiles and histogram\n");
+    tree* t = tree_new_flags(TREE_AUGMENTED);
+    assert(tree_quantile(t, 0.5) == NULL);
+    // latencies 1..100, where 100 was seen 100 times
+    for (long v = 1; v <= 100; v++) {
+        tree_insert(t, v);
+    }
+    for (int i = 1; i < 100; i++) {
+        tree_insert(t, 100);
+    }
+    // 199 values, the median is the 100th
+    assert(tree_quantile(t, 0)->d == 1);
+    assert(tree_quantile(t, 0.5)->d == 100);
+    assert(tree_quantile(t, 0.25)->d == 50);
+    assert(tree_quantile(t, 0.99)->d == 100);
+    assert(tree_quantile(t, 1)->d == 100);
+    assert(tree_quantile(t, 0.001)->d == 1);
+
+    double qs[] = {0.99, 0.25, 0, 0.5, 0.25};
+    tree_node* out[5];
+    tree_quantiles(t, qs, 5, out);
+    for (int i = 0; i < 5; i++) {
+        assert(out[i] == tree_quantile(t, qs[i]));
+    }
+
+    long edges[] = {0, 10, 50, 100, 101};
+    unsigned long counts[4];
+    assert(tree_histogram(t, edges, 4, counts) == 199);
+    assert(counts[0] == 9);
+    assert(counts[1] == 40);
+    assert(counts[2] == 50);
+    assert(counts[3] == 100);
+    long narrow[] = {20, 30};
+    assert(tree_histogram(t, narrow, 1, counts) == 10);
+    _tree_free(t);
+}
+
+void test_freeze() {
+    printf("testing freeze\n");
+    tree* t = tree_new();
+    frozen* f = tree_freeze(t);
+    assert(f->n == 0);
+    assert(frozen_search(f, 1) == 0);
+    assert(frozen_lower_bound(f, 1) == 0);
+    assert(frozen_count_range(f, 0, 10) == 0);
+    frozen_free(f);
+
+    // even keys 0..198, key k appears k / 10 + 1 times
+    for (long i = 0; i < 200; i += 2) {
+        for (long j = 0; j <= i / 10; j++) {
+            tree_insert(t, i);
+        }
+    }
+    f = tree_freeze(t);
+    assert(f->n == 100);
+    for (long i = -1; i < 201; i++) {
+        size_t x = frozen_search(f, i);
+        tree_node* n = tree_search(t, i);
+        if (n == NULL) {
+            assert(x == 0);
+            assert(frozen_count(f, i) == 0);
+        } else {
+            assert(f->k[x] == i);
+            assert(frozen_count(f, i) == n->c);
+        }
+        tree_node* lb = tree_lower_bound(t, i);
+        x = frozen_lower_bound(f, i);
+        assert(lb == NULL ? x == 0 : f->k[x] == lb->d);
+    }
+    unsigned long all = 0;
+    for (long i = 0; i < 200; i += 2) {
+        all += i / 10 + 1;
+    }
+    assert(f->s == all);
+    assert(frozen_count_range(f, LONG_MIN, LONG_MAX) == all);
+    // 10, 12, 14, 16, 18 twice each, 20 three times
+    assert(frozen_count_range(f, 10, 21) == 13);
+    assert(frozen_count_range(f, 11, 12) == 0);
+    assert(frozen_count_range(f, 21, 10) == 0);
+    // the snapshot doesn't see later changes
+    tree_insert(t, 1);
+    assert(frozen_search(f, 1) == 0);
+    frozen_free(f);
+    _tree_free(t);
+}
+
+struct btree_walk {
+    long last;
+    unsigned long total;
+};
+
+bool btree_walk_add(long d, unsigned c, void* arg) {
+    struct btree_walk* w = arg;
+    assert(d > w->last);
+    w->last = d;
+    w->total += c;
+    return true;
+}
+
+bool btree_walk_stop(long d, unsigned c, void* arg) {
+    return d < *(long*) arg;
+}
+
+void test_snapshot() {
+    printf("testing snapshots\n");
+    char path[] = "/tmp/tree-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    tree* t = tree_new();
+    assert(tree_save(t, path));
+    frozen* f = tree_open_mmap(path);
+    assert(f != NULL && f->n == 0);
+    assert(frozen_count(f, 1) == 0);
+    frozen_free(f);
+    for (long v = 0; v < 3000; v += 3) {
+        tree_insert(t, v);
+        if (v % 2 == 0) tree_insert(t, v);
+    }
+    assert(tree_save(t, path));
+    f = tree_open_mmap(path);
+    assert(f != NULL && f->n == 1000 && f->s == 1500);
+    for (long v = -1; v < 3000; v++) {
+        assert(frozen_count(f, v) == (v % 3 != 0 ? 0 : v % 2 == 0 ? 2 : 1));
+    }
+    assert(frozen_count_range(f, 0, 6) == 3);
+    tree* u = frozen_thaw(f, TREE_AUGMENTED);
+    tree_node_check(_get_root(u));
+    assert(tree_size(u) == 1000);
+    assert(tree_rank(u, 6) == 3);
+    _tree_free(u);
+    frozen_free(f);
+
+    // thawed on the first write, and only then
+    ltree* l = ltree_open(path, 0);
+    assert(l != NULL && l->t == NULL);
+    assert(ltree_search(l, 6) == 2);
+    assert(!ltree_remove(l, 1));
+    assert(l->t == NULL);
+    assert(ltree_remove(l, 6));
+    assert(l->t != NULL && l->f == NULL);
+    assert(ltree_search(l, 6) == 1);
+    ltree_insert(l, 1);
+    assert(ltree_size(l) == 1001);
+    assert(tree_search(ltree_tree(l), 1)->c == 1);
+    ltree_free(l);
+
+    f = tree_open_mmap_verified(path);
+    assert(f != NULL && frozen_count(f, 6) == 2);
+    frozen_free(f);
+
+    // damage to the body is caught by the sum, to the header always,
+    // and keys out of order by a thaw
+    FILE* o = fopen(path, "r+b");
+    assert(o != NULL);
+    assert(fseek(o, sizeof(snapshot_header) + 8, SEEK_SET) == 0);
+    long big = LONG_MAX;
+    assert(fwrite(&big, sizeof(big), 1, o) == 1);
+    fclose(o);
+    assert(tree_open_mmap_verified(path) == NULL && errno == EINVAL);
+    f = tree_open_mmap(path);
+    assert(f != NULL && f->n == 1000);
+    assert(frozen_thaw(f, 0) == NULL && errno == EINVAL);
+    frozen_free(f);
+    l = ltree_open(path, 0);
+    assert(l != NULL);
+    assert(!ltree_insert(l, 1) && l->t == NULL && l->f != NULL);
+    errno = 0;
+    assert(!ltree_remove(l, 3) && errno == EINVAL);
+    ltree_free(l);
+    o = fopen(path, "r+b");
+    assert(o != NULL);
+    assert(fputc('X', o) != EOF);
+    fclose(o);
+    assert(tree_open_mmap(path) == NULL);
+    assert(ltree_open(path, 0) == NULL);
+    assert(truncate(path, 10) == 0);
+    assert(tree_open_mmap(path) == NULL);
+    unlink(path);
+    assert(tree_open_mmap(path) == NULL);
+    assert(!tree_save(t, "/nonexistent/dir/snapshot"));
+    _tree_free(t);
+}
+
+void test_stream() {
+    printf("testing streams\n");
+    tree* t = tree_new();
+    // enough keys for several chunks
+    for (long v = -199997; v < 200000; v += 7) {
+        tree_insert(t, v);
+    }
+    tree_insert(t, LONG_MIN);
+    tree_insert(t, LONG_MAX);
+    tree_insert(t, LONG_MAX);
+    tree_insert(t, 0);
+    FILE* o = tmpfile();
+    assert(o != NULL);
+    assert(tree_stream_write(t, o));
+    long z = ftell(o);
+    rewind(o);
+    tree* u = tree_stream_read(o, TREE_AUGMENTED);
+    assert(u != NULL);
+    assert(getc(o) == EOF);
+    tree_node_check(_get_root(u));
+    check_bf(_get_root(u));
+    assert(tree_size(u) == tree_size(t));
+    assert(tree_search(u, LONG_MIN)->c == 1);
+    assert(tree_search(u, LONG_MAX)->c == 2);
+    assert(tree_search(u, 0)->c == 2);
+    assert(tree_search(u, 7)->c == 1);
+    assert(tree_search(u, 8) == NULL);
+    assert(tree_rank(u, 0) == 200000 / 7 + 1);
+    _tree_free(u);
+
+    // cut short, or not a stream at all
+    rewind(o);
+    assert(ftruncate(fileno(o), z - 1) == 0);
+    assert(tree_stream_read(o, 0) == NULL);
+    rewind(o);
+    assert(fputs("AVLSTRX", o) >= 0);
+    rewind(o);
+    assert(tree_stream_read(o, 0) == NULL);
+    fclose(o);
+
+    // an empty tree is still a stream
+    _tree_free(t);
+    t = tree_new();
+    o = tmpfile();
+    assert(tree_stream_write(t, o));
+    rewind(o);
+    u = tree_stream_read(o, 0);
+    assert(u != NULL && tree_size(u) == 0);
+    fclose(o);
+    _tree_free(u);
+    _tree_free(t);
+
+    // a size of 0 spelled in ten bytes, the last with bits past 64
+    o = tmpfile();
+    assert(fwrite(STREAM_MAGIC, 1, 7, o) == 7 && fputc(STREAM_VERSION, o) != EOF);
+    for (int i = 0; i < 9; i++) assert(fputc(0x80, o) != EOF);
+    assert(fputc(0x02, o) != EOF && fputc(0, o) != EOF);
+    rewind(o);
+    assert(tree_stream_read(o, 0) == NULL);
+    fclose(o);
+}
+
+/*
+    t and r hold the same keys and counts
+*/
+void check_wal(tree* t, tree* r) {
+    tree_node_check(_get_root(t));
+    assert(tree_size(t) == tree_size(r));
+    tree_cursor a, b;
+    tree_node* y = tree_cursor_first(&b, r);
+    for (tree_node* x = tree_cursor_first(&a, t); x != NULL; x = tree_cursor_next(&a)) {
+        assert(y != NULL && x->d == y->d && x->c == y->c);
+        y = tree_cursor_next(&b);
+    }
+    assert(y == NULL);
+}
+
+/*
+    some inserts and removes, to r and (unless it's NULL) w
+*/
+void wal_updates(wtree* w, tree* r, long lo, long hi) {
+    for (long v = lo; v < hi; v++) {
+        if (w != NULL) assert(wtree_insert(w, v % 97));
+        tree_insert(r, v % 97);
+        if (v % 3 == 0) {
+            bool hit = tree_remove(r, (v * 7) % 97);
+            assert(w == NULL || wtree_remove(w, (v * 7) % 97) == hit);
+        }
+    }
+}
+
+void test_wal() {
+    printf("testing write-ahead log\n");
+    char dir[] = "/tmp/tree-wal-XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    char path[64], snap[64], log[64];
+    snprintf(path, sizeof(path), "%s/t", dir);
+    snprintf(snap, sizeof(snap), "%s/t.snap", dir);
+    snprintf(log, sizeof(log), "%s/t.wal", dir);
+    wal_options o = wal_defaults();
+    o.group = 16;
+    o.checkpoint = 0;
+    tree* r = tree_new();
+
+    // replayed, with no snapshot yet
+    wtree* w = wtree_open(path, &o);
+    assert(w != NULL && tree_size(wtree_tree(w)) == 0);
+    assert(!wtree_remove(w, 1));
+    wal_updates(w, r, 0, 1000);
+    check_wal(wtree_tree(w), r);
+    assert(wtree_close(w));
+    assert(access(snap, F_OK) != 0);
+    w = wtree_open(path, &o);
+    assert(w != NULL);
+    check_wal(wtree_tree(w), r);
+
+    // a crash keeps what was synced: the child dies without a close
+    o.sync = WAL_SYNC_ALWAYS;
+    assert(wtree_close(w));
+    w = wtree_open(path, &o);
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        wal_updates(w, r, 1000, 1500);
+        _exit(0);
+    }
+    assert(waitpid(p, NULL, 0) == p);
+    assert(wtree_close(w));
+    wal_updates(NULL, r, 1000, 1500);
+    w = wtree_open(path, &o);
+    assert(w != NULL);
+    check_wal(wtree_tree(w), r);
+    assert(wtree_close(w));
+
+    // a torn frame is cut off
+    struct stat st;
+    assert(stat(log, &st) == 0);
+    FILE* f = fopen(log, "ab");
+    assert(f != NULL);
+    assert(fwrite("\x05\0\0\0\x01\x02\x03", 1, 7, f) == 7);
+    fclose(f);
+    w = wtree_open(path, &o);
+    assert(w != NULL);
+    check_wal(wtree_tree(w), r);
+    struct stat cut;
+    assert(stat(log, &cut) == 0 && cut.st_size == st.st_size);
+    wal_updates(w, r, 1500, 1600);
+
+    // a failed log write refuses its update and every one after
+    assert(wtree_error(w) == 0);
+    int fd = w->fd;
+    w->fd = -1;
+    assert(!wtree_insert(w, 5000) && errno == EBADF);
+    assert(tree_search(wtree_tree(w), 5000) == NULL);
+    long d = _get_root(r)->d;
+    assert(!wtree_remove(w, d) && wtree_error(w) == EBADF);
+    check_wal(wtree_tree(w), r);
+    assert(!wtree_sync(w) && errno == EBADF);
+    assert(!wtree_close(w));
+    close(fd);
+    w = wtree_open(path, &o);
+    assert(w != NULL);
+    check_wal(wtree_tree(w), r);
+    assert(wtree_close(w));
+
+    // checkpoints, with and without their new log
+    o.sync = WAL_SYNC_GROUP;
+    o.checkpoint = 100;
+    w = wtree_open(path, &o);
+    check_wal(wtree_tree(w), r);
+    wal_updates(w, r, 1600, 2000);
+    assert(access(snap, F_OK) == 0);
+    assert(wtree_close(w));
+    w = wtree_open(path, &o);
+    check_wal(wtree_tree(w), r);
+    assert(tree_save(wtree_tree(w), snap));
+    assert(wtree_close(w));
+    w = wtree_open(path, &o);
+    check_wal(wtree_tree(w), r);
+    assert(wtree_close(w));
+
+    // a bad log isn't guessed at
+    f = fopen(log, "wb");
+    assert(fputs("AVLWLOX", f) >= 0);
+    fclose(f);
+    assert(wtree_open(path, &o) == NULL);
+    unlink(log);
+    unlink(snap);
+    rmdir(dir);
+    assert(wtree_open("/nonexistent/dir/t", &o) == NULL);
+    _tree_free(r);
+}
+
+void test_btree() {
+    printf("testing btree\n");
+    btree* b = btree_new();
+    assert(btree_search(b, 1) == 0);
+    assert(!btree_remove(b, 1));
+    assert(btree_inorder(b, btree_walk_add, NULL) == 0);
+    // enough keys for three levels, inserted from both ends
+    long cnt = 20000;
+    for (long i = 0; i < cnt / 2; i++) {
+        btree_insert(b, i);
+        btree_insert(b, cnt - 1 - i);
+    }
+    btree_insert(b, 7);
+    btree_insert(b, 7);
+    assert(btree_size(b) == cnt);
+    assert(_btree_check(b) == cnt);
+    assert(btree_search(b, 7) == 3);
+    assert(btree_search(b, cnt) == 0);
+    assert(btree_search(b, -1) == 0);
+    struct btree_walk w = {-1, 0};
+    assert(btree_inorder(b, btree_walk_add, &w) == cnt);
+    assert(w.total == cnt + 2);
+    long stop = 10;
+    assert(btree_inorder(b, btree_walk_stop, &stop) == 11);
+
+    assert(btree_remove(b, 7));
+    assert(btree_search(b, 7) == 2);
+    assert(btree_size(b) == cnt);
+    // every other key, then the rest, checking as the tree shrinks
+    for (long i = 0; i < cnt; i += 2) {
+        assert(btree_remove(b, i));
+        assert(!btree_remove(b, i));
+    }
+    assert(_btree_check(b) == cnt / 2);
+    for (long i = cnt - 1; i > 0; i -= 2) {
+        if (i == 7) continue;
+        assert(btree_remove(b, i));
+        if (i % 1001 == 0) _btree_check(b);
+    }
+    assert(btree_size(b) == 1);
+    assert(btree_search(b, 7) == 2);
+    assert(btree_remove(b, 7));
+    assert(btree_remove(b, 7));
+    assert(btree_size(b) == 0);
+    assert(b->r == NULL);
+    btree_insert(b, 3);
+    assert(btree_search(b, 3) == 1);
+    // the extremes are keys like any other, LONG_MAX padding or not
+    for (long i = 0; i < 100; i++) {
+        btree_insert(b, i);
+    }
+    btree_insert(b, LONG_MAX);
+    btree_insert(b, LONG_MIN);
+    btree_insert(b, LONG_MAX);
+    assert(_btree_check(b) == 102);
+    assert(btree_search(b, LONG_MAX) == 2 && btree_search(b, LONG_MIN) == 1);
+    assert(btree_remove(b, LONG_MAX) && btree_remove(b, LONG_MAX) && !btree_remove(b, LONG_MAX));
+    assert(_btree_check(b) == 101);
+    btree_free(b);
+}
+
+void test_compact() {
+    printf("testing compact tree\n");
+    assert(sizeof(ctree_node) == 24);
+    ctree* t = ctree_new();
+    assert(ctree_search(t, 1) == 0);
+    assert(!ctree_remove(t, 1));
+    // ascending and descending runs exercise every rotation
+    long cnt = 5000;
+    for (long i = 0; i < cnt; i++) {
+        ctree_insert(t, i);
+        ctree_insert(t, -i - 1);
+    }
+    ctree_insert(t, 10);
+    assert(ctree_size(t) == 2 * cnt);
+    assert(ctree_search(t, 10) == 2);
+    assert(ctree_search(t, cnt) == 0);
+    int h = _ctree_check(t);
+    // an avl tree is at most 1.44 lg n high
+    assert(h <= 20);
+    struct btree_walk w = {LONG_MIN, 0};
+    assert(ctree_inorder(t, btree_walk_add, &w) == 2 * cnt);
+    assert(w.total == 2 * cnt + 1);
+    long stop = -cnt + 10;
+    assert(ctree_inorder(t, btree_walk_stop, &stop) == 11);
+
+    // removes from the middle out, including the root each time
+    // round, then reuse of the freed slots
+    assert(ctree_remove(t, 10));
+    assert(ctree_search(t, 10) == 1);
+    uint32_t z = t->z;
+    while (ctree_size(t) > cnt) {
+        long d = t->v[t->r].d;
+        assert(ctree_remove(t, d));
+        assert(ctree_search(t, d) == 0);
+        if (ctree_size(t) % 500 == 0) _ctree_check(t);
+    }
+    for (long i = 0; i < cnt; i++) {
+        ctree_insert(t, 2 * cnt + i);
+    }
+    assert(t->z == z);
+    _ctree_check(t);
+    while (ctree_size(t) > 0) {
+        assert(ctree_remove(t, t->v[t->r].d));
+    }
+    assert(t->r == CTREE_NIL);
+    ctree_insert(t, 3);
+    assert(ctree_search(t, 3) == 1);
+    ctree_free(t);
+
+    // a full tree refuses new keys, and takes them again once
+    // a slot is freed
+    t = ctree_new();
+    t->m = 100;
+    for (long i = 0; i < 100; i++) {
+        assert(ctree_insert(t, i));
+    }
+    assert(!ctree_insert(t, 100));
+    assert(ctree_insert(t, 5) && ctree_search(t, 5) == 2);
+    assert(t->n == 101 && t->z == 101);
+    assert(ctree_size(t) == 100 && ctree_search(t, 100) == 0);
+    _ctree_check(t);
+    assert(ctree_remove(t, 50));
+    assert(ctree_insert(t, 100));
+    _ctree_check(t);
+    ctree_free(t);
+}
+
+void test_pathtree() {
+    printf("testing parent free tree\n");
+    assert(sizeof(ptree_node) == 32);
+    ptree* t = ptree_new();
+    assert(ptree_search(t, 1) == NULL);
+    assert(!ptree_remove(t, 1));
+    long cnt = 5000;
+    for (long i = 0; i < cnt; i++) {
+        ptree_insert(t, i);
+        ptree_insert(t, -i - 1);
+    }
+    ptree_insert(t, 10);
+    assert(ptree_size(t) == 2 * cnt);
+    assert(ptree_search(t, 10)->c == 2);
+    assert(ptree_search(t, cnt) == NULL);
+    assert(_ptree_check(t) <= 20);
+    struct btree_walk w = {LONG_MIN, 0};
+    assert(ptree_inorder(t, btree_walk_add, &w) == 2 * cnt);
+    assert(w.total == 2 * cnt + 1);
+    long stop = -cnt + 10;
+    assert(ptree_inorder(t, btree_walk_stop, &stop) == 11);
+
+    assert(ptree_remove(t, 10));
+    assert(ptree_search(t, 10)->c == 1);
+    // the root has two children until the very end, so this is the
+    // successor case every time round
+    while (ptree_size(t) > 0) {
+        long d = t->r->d;
+        assert(ptree_remove(t, d));
+        assert(ptree_search(t, d) == NULL);
+        if (ptree_size(t) % 500 == 0) _ptree_check(t);
+    }
+    assert(t->r == NULL);
+    ptree_insert(t, 3);
+    assert(ptree_search(t, 3)->c == 1);
+    ptree_free(t);
+}
+
+void test_remove_root() {
+    printf("testing root removal\n");
+    // the root is replaced by a splice, not a rotation, so the
+    // retrace can stop short of it and the tree has to notice
+    tree* t = tree_new();
+    for (long i = 0; i < 1000; i++) {
+        tree_insert(t, i);
+    }
+    while (tree_size(t) > 0) {
+        long d = _get_root(t)->d;
+        assert(tree_remove(t, d));
+        assert(tree_search(t, d) == NULL);
+        if (tree_size(t) > 0) {
+            assert(_get_root(t)->p == NULL);
+            _check_tree(t);
+        }
+    }
+    assert(_get_root(t) == NULL);
+    _tree_free(t);
+}
+
+void test_rcu_tree() {
+    printf("testing rcu tree\n");
+    rtree* t = rtree_new(2);
+    rtree_reader* r = rtree_reader_new(t);
+    rtree_read_lock(r);
+    assert(rtree_search(t, 1) == 0);
+    rtree_read_unlock(r);
+    assert(!rtree_remove(t, 1));
+    long cnt = 2000;
+    for (long i = 0; i < cnt; i++) {
+        rtree_insert(t, i);
+    }
+    rtree_insert(t, 5);
+    assert(rtree_size(t) == cnt);
+    assert(_rtree_check(t) <= 15);
+
+    // a reader keeps its version while the writer moves on
+    rtree_read_lock(r);
+    struct btree_walk w = {LONG_MIN, 0};
+    assert(rtree_range(t, 0, cnt, btree_walk_add, &w) == cnt);
+    assert(w.total == cnt + 1);
+    long stop = 10;
+    assert(rtree_range(t, 5, LONG_MAX, btree_walk_stop, &stop) == 6);
+    assert(rtree_range(t, 100, 100, btree_walk_add, &w) == 0);
+    for (long i = 0; i < cnt; i += 2) {
+        assert(rtree_remove(t, i));
+    }
+    assert(rtree_search(t, 5) == 2);
+    assert(rtree_remove(t, 5));
+    // nodes this reader might hold on to are still waiting
+    assert(t->nl > 0);
+    rtree_read_unlock(r);
+    assert(rtree_search(t, 5) == 1);
+    assert(rtree_search(t, 4) == 0);
+    assert(rtree_size(t) == cnt / 2);
+    _rtree_check(t);
+    // and are freed by a later write once it has left
+    rtree_insert(t, 0);
+    for (long i = 0; i < 100; i++) {
+        rtree_remove(t, 0);
+        rtree_insert(t, 0);
+    }
+    assert(t->nl < 200);
+    while (rtree_size(t) > 0) {
+        rtree_remove(t, atomic_load(&t->r)->d);
+    }
+    _rtree_check(t);
+    rtree_free(t);
+}
+
+void test_cow() {
+    printf("testing copy-on-write snapshots\n");
+    vtree* t = vtree_new();
+    vview* v = vtree_snapshot(t);
+    assert(vview_size(v) == 0 && vview_search(v, 1) == 0);
+    vview_release(v);
+    assert(!vtree_remove(t, 1));
+    long cnt = 2000;
+    for (long i = 0; i < cnt; i++) {
+        vtree_insert(t, i);
+    }
+    vtree_insert(t, 5);
+    assert(vtree_size(t) == cnt);
+    int h = _vtree_check(t);
+    assert(h <= 15);
+    // nothing shared yet, so nothing was copied
+    assert(t->n == cnt);
+
+    // a snapshot is a reference, and the first write copies a path
+    vview* a = vtree_snapshot(t);
+    assert(t->n == cnt);
+    vtree_insert(t, cnt);
+    assert(t->n - (cnt + 1) <= (unsigned long) h + 2);
+    for (long i = 0; i < cnt; i += 2) {
+        assert(vtree_remove(t, i));
+    }
+    assert(vtree_remove(t, 5));
+    _vtree_check(t);
+    assert(vtree_size(t) == cnt / 2 + 1);
+    assert(vtree_search(t, 5) == 1 && vtree_search(t, 4) == 0);
+    assert(vview_size(a) == cnt);
+    assert(vview_search(a, 5) == 2 && vview_search(a, 4) == 1 && vview_search(a, cnt) == 0);
+    struct btree_walk w = {LONG_MIN, 0};
+    assert(vview_inorder(a, btree_walk_add, &w) == cnt);
+    assert(w.total == cnt + 1);
+    long stop = 10;
+    assert(vview_inorder(a, btree_walk_stop, &stop) == 11);
+
+    // versions go when their last reference does, in any order
+    vview* b = vtree_snapshot(t);
+    vview* c = vtree_snapshot(t);
+    for (long i = 1; i < cnt; i += 4) {
+        assert(vtree_remove(t, i));
+    }
+    vview_release(a);
+    assert(t->n < 2 * cnt);
+    assert(vview_size(b) == cnt / 2 + 1 && vview_search(b, 1) == 1);
+    vview_release(c);
+    w = (struct btree_walk) {LONG_MIN, 0};
+    assert(vview_inorder(b, btree_walk_add, &w) == cnt / 2 + 1);
+    vview_release(b);
+    assert(t->n == vtree_size(t));
+    _vtree_check(t);
+    while (vtree_size(t) > 0) {
+        assert(vtree_remove(t, t->r->d));
+    }
+    assert(t->n == 0);
+    vtree_free(t);
+}
+
+void test_shard() {
+    printf("testing sharded tree\n");
+    long splits[] = {-100, 0, 100};
+    stree* ss[] = {stree_new(7), stree_new_range(splits, 4), stree_new(1)};
+    for (int i = 0; i < 3; i++) {
+        stree* s = ss[i];
+        assert(stree_search(s, 1) == 0);
+        assert(!stree_remove(s, 1));
+        struct btree_walk w = {LONG_MIN, 0};
+        assert(stree_inorder(s, btree_walk_add, &w) == 0);
+        for (long d = -300; d < 300; d += 3) {
+            stree_insert(s, d);
+        }
+        stree_insert(s, 0);
+        stree_insert(s, 99);
+        assert(stree_size(s) == 200);
+        assert(stree_search(s, 0) == 2);
+        assert(stree_search(s, 99) == 2);
+        assert(stree_search(s, 100) == 0);
+        // the merge comes out in order, with every count
+        assert(stree_inorder(s, btree_walk_add, &w) == 200);
+        assert(w.total == 202);
+        long stop = -290;
+        assert(stree_inorder(s, btree_walk_stop, &stop) == 5);
+        assert(stree_remove(s, 0));
+        assert(stree_search(s, 0) == 1);
+        for (long d = -300; d < 300; d += 3) {
+            assert(stree_remove(s, d));
+        }
+        assert(stree_size(s) == 1);
+        assert(stree_search(s, 99) == 1);
+        stree_free(s);
+    }
+}
+
 int main() {
 
     test__update_bf_insert();
@@ -556,15 +1897,54 @@ int main() {
 
     test_lopsided();
 
+    test_left_right_balance();
+
     test_insert_correctness();
 
     test__remove_no_right_children();
 
     test__remove_right_no_left();
 
+    test_remove_relink();
+
     test__remove_complex();
 
+    test_remove_root();
+
     test_tree_inorder();
 
+    test_slab();
+
+    test_build_sorted();
+    test_build();
+
+    test_batch();
+
+    test_cursor();
+
+    test_range();
+
+    test_order_statistics();
+
+    test_quantiles();
+    test_split_join();
+    test_set_ops();
+
+    test_freeze();
+    test_snapshot();
+    test_stream();
+    test_wal();
+
+    test_btree();
+
+    test_compact();
+
+    test_pathtree();
+
+    test_rcu_tree();
+    test_cow();
+
+    test_shard();
+
     return 0;
 }
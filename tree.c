@@ -1,17 +1,199 @@
+// see static.h
+#define TREE_SOURCE
+
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../log/log.h"
+#include "release.h"
 #include "../queue/queue.h"
 #include "../tree-node/tree_node.h"
 
+#include "slab.h"
 #include "tree.h"
 // tree internal function prototypes
 #include "static.h"
 
+unsigned long tree_count_range(tree* t, long lo, long hi) {
+    if (hi <= lo) return 0;
+    return tree_rank(t, hi) - tree_rank(t, lo);
+}
+
+tree* tree_build(const long* d, size_t n, unsigned f, int threads) {
+    tree* t = tree_new_flags(f & ~TREE_BUILD_DEDUP);
+    if (n == 0) return t;
+    int nb = threads > 1 && n >= TREE_BUILD_FORK * 8 ? threads : 1;
+    long* k = malloc(sizeof(long) * n);
+    unsigned* c = malloc(sizeof(unsigned) * n);
+    long* s = malloc(sizeof(long) * nb * 64);
+    size_t* at = calloc((size_t) nb * nb, sizeof(size_t));
+    build_sort* b = malloc(sizeof(build_sort) * nb);
+    Assert(k != NULL && c != NULL && s != NULL && at != NULL && b != NULL, __func__, "malloc error");
+
+    // splitters from an even sample of the input
+    size_t ns = (size_t) nb * 64;
+    for (size_t i = 0; i < ns; i++) {
+        s[i] = d[i * (n / ns)];
+    }
+    qsort(s, ns, sizeof(long), _long_cmp);
+    for (int i = 1; i < nb; i++) {
+        s[i - 1] = s[i * 64];
+    }
+    for (int i = 0; i < nb; i++) {
+        b[i] = (build_sort) {d + i * n / nb, (i + 1) * n / nb - i * n / nb, s, nb, at + i * nb, k, c, 0, 0, 0, f & TREE_BUILD_DEDUP};
+    }
+    _build_run(_build_count, b, sizeof(build_sort), nb);
+
+    // lay the buckets out end to end, each chunk's share in order
+    size_t o = 0;
+    for (int j = 0; j < nb; j++) {
+        b[j].lo = o;
+        for (int i = 0; i < nb; i++) {
+            size_t x = b[i].at[j];
+            b[i].at[j] = o;
+            o += x;
+        }
+        b[j].hi = o;
+    }
+    _build_run(_build_scatter, b, sizeof(build_sort), nb);
+    _build_run(_build_fold, b, sizeof(build_sort), nb);
+    size_t m = 0;
+    for (int j = 0; j < nb; j++) {
+        memmove(k + m, k + b[j].lo, sizeof(long) * b[j].m);
+        memmove(c + m, c + b[j].lo, sizeof(unsigned) * b[j].m);
+        m += b[j].m;
+    }
+    free(b);
+    free(at);
+    free(s);
+
+    // the slab isn't thread safe, so its nodes are taken first
+    tree_node** nodes = NULL;
+    if (t->a != NULL) {
+        nodes = malloc(sizeof(tree_node*) * m);
+        Assert(nodes != NULL, __func__, "malloc error");
+        for (size_t i = 0; i < m; i++) {
+            nodes[i] = slab_node_new(t->a, k[i]);
+        }
+    }
+    build_job j = {t, k, c, nodes, 0, m, threads, NULL, 0};
+    _build_range(&j);
+    t->r = j.r;
+    t->s = m;
+    free(nodes);
+    free(c);
+    free(k);
+    return t;
+}
+
+tree* tree_build_sorted(const long* keys, const unsigned* counts, size_t n) {
+    return tree_build_sorted_flags(keys, counts, n, 0);
+}
+
+tree* tree_build_sorted_flags(const long* keys, const unsigned* counts, size_t n, unsigned f) {
+    tree* t = tree_new_flags(f);
+    sorted_run in = {keys, counts, 0, n};
+    unsigned long m = 0;
+    for (size_t i = 0; i < n; i++) {
+        Assert(i == 0 || keys[i - 1] <= keys[i], __func__, "keys not sorted at %lu", (unsigned long) i);
+        if (i == 0 || keys[i - 1] != keys[i]) m++;
+    }
+    int h;
+    t->r = _build_sorted(t, &in, m, &h);
+    t->s = m;
+    return t;
+}
+
+tree* tree_concat(tree* l, tree* r) {
+    if (!_join_check(l, r)) return NULL;
+    Assert(l->r == NULL || r->r == NULL || _rightmost(l->r)->d < _leftmost(r->r)->d, __func__, "trees overlap");
+    int h;
+    l->r = _join_concat(l, l->r, _height(l->r), r->r, _height(r->r), &h);
+    l->s += r->s;
+    free(r);
+    return l;
+}
+
+tree* tree_build_next(unsigned long m, bool (*next)(long* d, unsigned* c, void* arg), void* arg, unsigned f) {
+    tree* t = tree_new_flags(f);
+    build_next in = {next, arg, true, false, 0};
+    int h;
+    t->r = _build_next(t, &in, m, &h);
+    t->s = m;
+    if (in.ok) return t;
+    _tree_free(t);
+    return NULL;
+}
+
+tree_node* tree_cursor_first(tree_cursor* c, tree* t) {
+    c->t = t;
+    c->n = _leftmost(_get_root(t));
+    return c->n;
+}
+
+tree_node* tree_cursor_last(tree_cursor* c, tree* t) {
+    c->t = t;
+    c->n = _rightmost(_get_root(t));
+    return c->n;
+}
+
+tree_node* tree_cursor_next(tree_cursor* c) {
+    if (c->n != NULL) c->n = _successor(c->n);
+    return c->n;
+}
+
+tree_node* tree_cursor_prev(tree_cursor* c) {
+    if (c->n != NULL) c->n = _predecessor(c->n);
+    return c->n;
+}
+
+tree_node* tree_cursor_seek(tree_cursor* c, tree* t, long d) {
+    c->t = t;
+    c->n = tree_lower_bound(t, d);
+    return c->n;
+}
+
+tree* tree_difference(tree* a, tree* b, int threads) {
+    return _set_trees(a, b, SET_DIFFERENCE, threads);
+}
+
+tree_node* tree_floor(tree* t, long d) {
+    tree_node* n = _get_root(t);
+    tree_node* x = NULL;
+    while (n != NULL) {
+        if (d < n->d) {
+            n = n->l;
+        } else if (d > n->d) {
+            x = n;
+            n = n->r;
+        } else return n;
+    }
+    return x;
+}
+
+tree_node* tree_ceiling(tree* t, long d) {
+    return tree_lower_bound(t, d);
+}
+
+unsigned long tree_histogram(tree* t, const long* edges, size_t n, unsigned long* counts) {
+    unsigned long total = 0;
+    if (n == 0) return 0;
+    unsigned long lo = tree_rank(t, edges[0]);
+    for (size_t i = 0; i < n; i++) {
+        Assert(edges[i] <= edges[i + 1], __func__, "edges not ascending at %lu", (unsigned long) i);
+        unsigned long hi = tree_rank(t, edges[i + 1]);
+        counts[i] = hi - lo;
+        total += counts[i];
+        lo = hi;
+    }
+    return total;
+}
+
 queue* tree_inorder(tree* t) {
     tree_node* r = _get_root(t);
     if (r == NULL) return NULL;
@@ -21,39 +203,89 @@ queue* tree_inorder(tree* t) {
 }
 
 void tree_insert(tree* t, long d) {
-    tree_node* n = _get_root(t);
-    tree_node* x;
-    if (n == NULL) {
-        x = tree_node_new(d);
-        t->r = x;
-        t->s += 1;
-        return;
+    _insert_count(t, d, 1);
+}
+
+void tree_insert_batch(tree* t, const long* d, size_t n) {
+    unsigned long m;
+    key_count* b = _batch_sort(d, n, &m);
+    if (_batch_merge(t, m)) {
+        _merge_insert(t, b, m);
+    } else {
+        for (unsigned long i = 0; i < m; i++) {
+            _insert_count(t, b[i].d, b[i].c);
+        }
     }
-    x = tree_search(t, d);
-    if (x) { // node already inserted, increment counter
-        x->c += 1;
-        return;
+    free(b);
+}
+
+tree* tree_intersection(tree* a, tree* b, int threads) {
+    return _set_trees(a, b, SET_INTERSECTION, threads);
+}
+
+tree* tree_join(tree* l, long d, tree* r) {
+    if (!_join_check(l, r)) return NULL;
+    Assert(l->r == NULL || _rightmost(l->r)->d < d, __func__, "left tree not below %li", d);
+    Assert(r->r == NULL || _leftmost(r->r)->d > d, __func__, "right tree not above %li", d);
+    int h;
+    l->r = _join(l, l->r, _height(l->r), _node_new(l, d), r->r, _height(r->r), &h);
+    l->s += r->s + 1;
+    free(r);
+    return l;
+}
+
+tree_node* tree_lower_bound(tree* t, long d) {
+    tree_node* n = _get_root(t);
+    tree_node* x = NULL;
+    while (n != NULL) {
+        if (d < n->d) {
+            x = n;
+            n = n->l;
+        } else if (d > n->d) {
+            n = n->r;
+        } else return n;
     }
-    x = tree_node_new(d);
-    n = _insert_node(n, x);
-    if (n->p == NULL) t->r = n;
-    t->s += 1;
+    return x;
 }
 
 tree* tree_new() {
+    return tree_new_flags(0);
+}
+
+tree* tree_new_flags(unsigned f) {
     tree* t = malloc(sizeof(tree));
     Assert(t != NULL, __func__, "malloc error");
     t->r = NULL;
     t->s = 0;
+    t->f = f;
+    t->a = f & TREE_SLAB ? slab_new(_node_size(t)) : NULL;
     return t;
 }
 
+/*
+    pre-order print, using an explicit stack rather than
+    recursion so a malformed (deep) tree can't blow the
+    call stack
+*/
 static void _node_print(tree_node* n) {
-    if (n != NULL) {
+    if (n == NULL) return;
+    unsigned long z = 64;
+    unsigned long i = 0;
+    tree_node** s = malloc(sizeof(tree_node*) * z);
+    Assert(s != NULL, __func__, "malloc error");
+    s[i++] = n;
+    while (i > 0) {
+        n = s[--i];
         printf("n: %lu, p: %lu, d: %li, c: %u l: %lu, r: %lu, b: %hd\n", (unsigned long) n, (unsigned long) n->p, n->d, n->c, (unsigned long) n->l, (unsigned long) n->r, n->b);
-        _node_print(n->l);
-        _node_print(n->r);
+        if (i + 2 > z) {
+            z *= 2;
+            s = realloc(s, sizeof(tree_node*) * z);
+            Assert(s != NULL, __func__, "realloc error");
+        }
+        if (n->r != NULL) s[i++] = n->r;
+        if (n->l != NULL) s[i++] = n->l;
     }
+    free(s);
 }
 
 void tree_print(tree* t) {
@@ -64,44 +296,89 @@ void tree_print(tree* t) {
 }
 
 bool tree_remove(tree* t, long d) {
-    tree_node* n = _get_root(t);
-    if (n == NULL) return false;
-    if (n->d == d && n->l == NULL && n->r == NULL && n->c == 1) {
-        Assert(t->s == 1, __func__, "root deletion, but size wrong, %lu", t->s);
-        t->r = NULL;
-        free(n);
-        t->s = 0;
-        return true;
-    }
-    n = tree_search(t, d);
+    tree_node* n = tree_search(t, d);
     if (n == NULL) return false;
     if (n->c > 1) {
         n->c -= 1;
+        _aug_add(t, n, -1);
         return true;
     }
-
-    tree_node* r;
-    if (n->r == NULL && n->l == NULL) {
-        r = _remove_no_children(n);
-    } else if (n->r == NULL) {
-        r = _remove_no_right_children(n);
-    } else if (n->r != NULL && n->r->l == NULL) {
-        r = _remove_right_no_left(n);
-    } else if (n->r != NULL && n->r->l != NULL) {
-        r = _remove_complex(n);
-    } else Assert(false, __func__, "unhandled node removal");
-    if (r == NULL) t->r = NULL;
-    if (r->p != NULL) Assert(false, __func__, "root parent not NULL: %li", r->d);
-    t->r = r;
-    free(n);
-    t->s -= 1;
+    _remove_node(t, n);
     return true;
 }
 
+unsigned long tree_range(tree* t, long lo, long hi, bool (*f)(tree_node* n, void* arg), void* arg) {
+    unsigned long k = 0;
+    for (tree_node* n = tree_lower_bound(t, lo); n != NULL && n->d < hi; n = _successor(n)) {
+        k++;
+        if (!f(n, arg)) break;
+    }
+    return k;
+}
+
+tree_node* tree_quantile(tree* t, double q) {
+    tree_node* n;
+    tree_quantiles(t, &q, 1, &n);
+    return n;
+}
+
+void tree_quantiles(tree* t, const double* qs, size_t n, tree_node** out) {
+    Assert(t->f & TREE_AUGMENTED, __func__, "tree not augmented");
+    tree_node* r = _get_root(t);
+    if (r == NULL || !(t->f & TREE_AUGMENTED)) {
+        for (size_t i = 0; i < n; i++) out[i] = NULL;
+        return;
+    }
+    unsigned long w = ((tree_anode*) r)->w;
+    rank_want* wants = malloc(sizeof(rank_want) * (n > 0 ? n : 1));
+    Assert(wants != NULL, __func__, "malloc error");
+    for (size_t i = 0; i < n; i++) {
+        wants[i].k = _quantile_rank(qs[i], w);
+        wants[i].i = i;
+    }
+    qsort(wants, n, sizeof(rank_want), _rank_want_cmp);
+    _select_many(r, wants, n, 0, out);
+    free(wants);
+}
+
+unsigned long tree_rank(tree* t, long d) {
+    return _rank(t, d, false);
+}
+
+unsigned long tree_rank_distinct(tree* t, long d) {
+    return _rank(t, d, true);
+}
+
+unsigned long tree_remove_batch(tree* t, const long* d, size_t n) {
+    unsigned long m;
+    key_count* b = _batch_sort(d, n, &m);
+    unsigned long removed = 0;
+    if (_batch_merge(t, m)) {
+        removed = _merge_remove(t, b, m);
+    } else {
+        for (unsigned long i = 0; i < m; i++) {
+            tree_node* x = tree_search(t, b[i].d);
+            if (x == NULL) continue;
+            if (x->c > b[i].c) {
+                x->c -= b[i].c;
+                _aug_add(t, x, -(long) b[i].c);
+                removed += b[i].c;
+            } else {
+                removed += x->c;
+                _remove_node(t, x);
+            }
+        }
+    }
+    free(b);
+    return removed;
+}
+
 static tree_node* _tree_search(tree_node* n, long d) {
-    if (n->d == d) return n;
-    if (d < n->d && n->l != NULL) return _tree_search(n->l, d);
-    if (d > n->d && n->r != NULL) return _tree_search(n->r, d);
+    while (n != NULL) {
+        if (d < n->d) n = n->l;
+        else if (d > n->d) n = n->r;
+        else return n;
+    }
     return NULL;
 }
     
@@ -112,15 +389,74 @@ tree_node* tree_search(tree* t, long d) {
     return _tree_search(n, d);
 }
 
+tree_node* tree_select(tree* t, unsigned long k) {
+    return _select(t, k, false);
+}
+
+tree_node* tree_select_distinct(tree* t, unsigned long k) {
+    return _select(t, k, true);
+}
+
 unsigned long tree_size(tree* t) {
     Assert(t != NULL, __func__, "t is null");
     return t->s;
 }
 
+bool tree_split(tree* t, long d, tree** l, tree** r) {
+    if (t->a != NULL) return false;
+    *l = tree_new_flags(t->f);
+    *r = tree_new_flags(t->f);
+    int hl, hr;
+    tree_node* m = _split(t, t->r, _height(t->r), d, &(*l)->r, &hl, &(*r)->r, &hr);
+    if (m != NULL) (*r)->r = _join(t, NULL, 0, m, (*r)->r, hr, &hr);
+    (*l)->s = _split_size(t, (*l)->r, (*r)->r);
+    (*r)->s = t->s - (*l)->s;
+    free(t);
+    return true;
+}
+
+tree* tree_union(tree* a, tree* b, int threads) {
+    return _set_trees(a, b, SET_UNION, threads);
+}
+
+tree_node* tree_upper_bound(tree* t, long d) {
+    tree_node* n = _get_root(t);
+    tree_node* x = NULL;
+    while (n != NULL) {
+        if (d < n->d) {
+            x = n;
+            n = n->l;
+        } else n = n->r;
+    }
+    return x;
+}
+
+/*
+    free every node under n without recursion or a stack:
+    rotate left children up until the top has none, then
+    free it and carry on down the right spine.  does not
+    rely on parent pointers
+*/
+static void _node_free_all(tree_node* n) {
+    tree_node* x;
+    while (n != NULL) {
+        if (n->l != NULL) {
+            x = n->l;
+            n->l = x->r;
+            x->r = n;
+            n = x;
+        } else {
+            x = n->r;
+            free(n);
+            n = x;
+        }
+    }
+}
+
 void _tree_free(tree* t) {
     tree_node* n = _get_root(t);
-    if (n == NULL) return;
-    tree_node_free_recurse(n);
+    if (t->a != NULL) slab_free(t->a);
+    else _node_free_all(n);
     free(t);
 }
 
@@ -133,9 +469,59 @@ void _tree_free(tree* t) {
     so the caller can update the root pointer
     if needed
 */
-STATIC tree_node* _insert_node(tree_node* n, tree_node* c) {
-    if (c->d < n->d && n->l != NULL) return _insert_node(n->l, c);
-    if (c->d > n->d && n->r != NULL) return _insert_node(n->r, c);
+tree_node* _insert_node(tree_node* n, tree_node* c) {
+    tree_node* top = _insert_attach(_insert_descend(n, c->d), c);
+    return top->p == NULL ? top : n;
+}
+
+/*
+    insert c copies of d into the tree
+*/
+STATIC void _insert_count(tree* t, long d, unsigned c) {
+    tree_node* n = _get_root(t);
+    tree_node* x;
+    if (n == NULL) {
+        x = _node_new(t, d);
+        x->c = c;
+        t->r = x;
+        t->s += 1;
+        _aug_fix(t, x);
+        return;
+    }
+    n = _insert_descend(n, d);
+    if (n->d == d) { // node already inserted, increment counter
+        n->c += c;
+        _aug_add(t, n, c);
+        return;
+    }
+    x = _node_new(t, d);
+    x->c = c;
+    if (t->f & TREE_AUGMENTED) n = _aug_insert_attach(n, x);
+    else n = _insert_attach(n, x);
+    if (n->p == NULL) t->r = n;
+    t->s += 1;
+}
+
+/*
+    single descent from n for d: returns the node holding d
+    if it is already in the tree, otherwise the node that
+    d would be attached under.  lets tree_insert find a
+    duplicate and the attach point in one walk
+*/
+STATIC tree_node* _insert_descend(tree_node* n, long d) {
+    while (true) {
+        if (d < n->d && n->l != NULL) n = n->l;
+        else if (d > n->d && n->r != NULL) n = n->r;
+        else return n;
+    }
+}
+
+/*
+    hang the new node c off of leaf-ish node n (as found by
+    _insert_descend) and retrace, returning the node the retrace
+    stopped at.  that is the root if it has no parent
+*/
+STATIC tree_node* _insert_attach(tree_node* n, tree_node* c) {
     LOG_DEBUG("inserting: %li", __func__, c->d);
     if (c->d < n->d && n->l == NULL) n->l = c;
     if (c->d > n->d && n->r == NULL) n->r = c;
@@ -147,15 +533,15 @@ STATIC tree_node* _insert_node(tree_node* n, tree_node* c) {
     node c was just inserted (and hence balance factor = 0)
     update its parent's balance factor, retracing up the tree
     rebalance if needed.
+
+    returns the node it stopped at: where the height change was
+    absorbed, the top of the (one) rotation, or the root.  the
+    root has only moved if that node has no parent, so callers
+    don't need to walk back up to find it
 */
 STATIC tree_node* _retrace_insert(tree_node* c) {
     LOG_DEBUG("retracing insert at %li", __func__, c->d);
     tree_node* p = c;
-    /*
-        note break cases:
-            if rebalance led to root page
-            if tree is balanced (no height changes)
-    */
     while (true) {
         p = p->p;
         _update_bf_insert(p, c);
@@ -165,7 +551,7 @@ STATIC tree_node* _retrace_insert(tree_node* c) {
         c = p;
     }
     LOG_DEBUG("new top: %li", __func__, p->d);
-    return _up_to_root(p);
+    return p;
 }
 
 STATIC void _update_bf_insert(tree_node* p, tree_node* c) {
@@ -178,7 +564,8 @@ STATIC void _update_bf_insert(tree_node* p, tree_node* c) {
 }
  
 /* 
-    node n just had a child removed, retrace and rebalance
+    node n just had a child removed, retrace and rebalance.
+    returns the node it stopped at, as _retrace_insert
 */
 STATIC tree_node* _retrace_remove(tree_node* n) {
     LOG_DEBUG("retracing removal from %li", __func__, n->d);
@@ -203,7 +590,7 @@ STATIC tree_node* _retrace_remove(tree_node* n) {
     Assert(n != NULL, __func__, "n null");
     LOG_DEBUG("new top: %li", __func__, n->d);
 
-    return _up_to_root(n);
+    return n;
 }
 
 /*
@@ -312,9 +699,10 @@ STATIC tree_node* _remove_right_no_left(tree_node* n) {
     tree_node* x = n->r;
     LOG_DEBUG("removing %li and replacing with %li", __func__, n->d, x->d);
     x->l = n->l;
+    if (x->l != NULL) x->l->p = x;
     x->b = n->b - 1;
     _remove_splice(p, n, x);
-    if (p == NULL && x->p == NULL) return x; // root page
+    // always retrace, x may be out of balance even at the root
     return _retrace_remove(x);
 }
 
@@ -358,8 +746,8 @@ STATIC tree_node* _remove_complex(tree_node* n) {
     LOG_DEBUG("removing %li, replacing with %li", __func__, n->d, c->d);
 
     // first, catch the child
-    if (c->r != NULL) c->p->l = c->r;
-    else c->p->l = NULL;
+    if (c->r != NULL) c->r->p = c->p;
+    c->p->l = c->r;
 
     // track the old parent for c, and note the height shrink
     tree_node* p = c->p;
@@ -537,11 +925,11 @@ STATIC tree_node* _left_left(tree_node* X) {
 
     pivot to:
 
-        Y b=0
-       / \
-b=0,1 Z   X b=-1,0
-     / \ / \
-   t0 t1 t2 t3
+         Y b=0
+        / \
+b=-1,0 Z   X b=0,1
+      / \ / \
+    t0 t1 t2 t3
 */
 STATIC tree_node* _left_right(tree_node* X) {
     LOG_DEBUG("LR rebalance of %li", __func__, X->d);
@@ -565,31 +953,836 @@ STATIC tree_node* _left_right(tree_node* X) {
         Z->b = 0;
     } else if (Y->b == -1) {
         LOG_DEBUG("insert on %li L", __func__, Y->d);
-        X->b = 0;
-        Z->b = 1;
+        X->b = 1;
+        Z->b = 0;
         Y->b = 0;
     } else if (Y->b == 1) {
         LOG_DEBUG("insert on %li R", __func__, Y->d);
-        X->b = -1;
-        Z->b = 0;
+        X->b = 0;
+        Z->b = -1;
         Y->b = 0;
     } else Assert(false, __func__, "unhandled balance factor for Y in left right case");
     return Y;
 }
 
 /*
-    some helper functions
+    height of the subtree under n, down the taller side each time
 */
-STATIC tree_node* _get_root(tree* t) {
-    Assert(t != NULL, __func__, "tree is null");
-    return t->r;
+STATIC int _height(tree_node* n) {
+    int h = 0;
+    while (n != NULL) {
+        h++;
+        n = n->b > 0 ? n->r : n->l;
+    }
+    return h;
 }
 
-STATIC tree_node* _up_to_root(tree_node* n) {
+/*
+    hang l and r (heights hl and hr) off of k
+*/
+STATIC void _join_hang(tree_node* k, tree_node* l, int hl, tree_node* r, int hr) {
+    k->l = l;
+    if (l != NULL) l->p = k;
+    k->r = r;
+    if (r != NULL) r->p = k;
+    k->b = hr - hl;
+}
+
+/*
+    join subtrees l and r (heights hl and hr) under k, where
+    l < k < r.  if one is more than a level taller, k goes down
+    its inner spine to the first subtree no more than a level
+    taller than the other, takes its place, and the extra level
+    is retraced as an insert would be.  returns the new top, and
+    its height in h
+*/
+STATIC tree_node* _join(tree* t, tree_node* l, int hl, tree_node* k, tree_node* r, int hr, int* h) {
+    k->p = NULL;
+    if (hl <= hr + 1 && hr <= hl + 1) {
+        _join_hang(k, l, hl, r, hr);
+        _aug_fix(t, k);
+        *h = (hl > hr ? hl : hr) + 1;
+        return k;
+    }
+    // the short side may be empty, so track where k will hang
+    tree_node* top;
+    tree_node* p = NULL;
+    if (hl > hr) {
+        top = l;
+        *h = hl;
+        while (hl > hr + 1) {
+            hl -= l->b < 0 ? 2 : 1;
+            p = l;
+            l = l->r;
+        }
+        p->r = k;
+    } else {
+        top = r;
+        *h = hr;
+        while (hr > hl + 1) {
+            hr -= r->b > 0 ? 2 : 1;
+            p = r;
+            r = r->l;
+        }
+        p->l = k;
+    }
+    k->p = p;
+    _join_hang(k, l, hl, r, hr);
+    tree_node* x = _retrace_insert(k);
+    _aug_fix(t, k);
+    // the retrace only reaches the top with a b of +-1 if it grew
+    if (x->p != NULL) return top;
+    if (x->b != 0) *h += 1;
+    return x;
+}
+
+/*
+    trees whose nodes can be moved between them.  checked in
+    release builds too, a slab's nodes can't leave it
+*/
+STATIC bool _join_check(tree* l, tree* r) {
+    return l->f == r->f && l->a == NULL && r->a == NULL;
+}
+
+/*
+    split the subtree under n (height h) at d into *l, values < d,
+    and *r, values > d, with their heights.  returns the node
+    holding d, taken out, or NULL.  each level joins its node and
+    the child not split onto one side.  the join costs are height
+    differences that telescope, so the whole split is O(log n)
+*/
+STATIC tree_node* _split(tree* t, tree_node* n, int h, long d, tree_node** l, int* hl, tree_node** r, int* hr) {
+    if (n == NULL) {
+        *l = NULL;
+        *r = NULL;
+        *hl = 0;
+        *hr = 0;
+        return NULL;
+    }
+    tree_node* a = n->l;
+    tree_node* b = n->r;
+    int ha = h - (n->b > 0 ? 2 : 1);
+    int hb = h - (n->b < 0 ? 2 : 1);
+    if (a != NULL) a->p = NULL;
+    if (b != NULL) b->p = NULL;
+    tree_node* m = n;
+    if (d == n->d) {
+        *l = a;
+        *hl = ha;
+        *r = b;
+        *hr = hb;
+    } else if (d < n->d) {
+        m = _split(t, a, ha, d, l, hl, r, hr);
+        *r = _join(t, *r, *hr, n, b, hb, hr);
+    } else {
+        m = _split(t, b, hb, d, l, hl, r, hr);
+        *l = _join(t, a, ha, n, *l, *hl, hl);
+    }
+    return m;
+}
+
+/*
+    join l and r (heights hl and hr) with nothing between them, by
+    taking r's smallest node out to go in the middle
+*/
+STATIC tree_node* _join_concat(tree* t, tree_node* l, int hl, tree_node* r, int hr, int* h) {
+    if (r == NULL) {
+        *h = hl;
+        return l;
+    }
+    tree_node* x;
+    tree_node* k = _split(t, r, hr, _leftmost(r)->d, &x, h, &r, &hr);
+    return _join(t, l, hl, k, r, hr, h);
+}
+
+/*
+    the number of nodes under a, where a and b between them hold
+    all of t's.  augmented trees have it at the top, otherwise
+    walk both in step and count whichever runs out first
+*/
+STATIC unsigned long _split_size(tree* t, tree_node* a, tree_node* b) {
+    if (t->f & TREE_AUGMENTED) return a != NULL ? ((tree_anode*) a)->s : 0;
+    tree_node* x = _leftmost(a);
+    tree_node* y = _leftmost(b);
+    unsigned long k = 0;
+    while (x != NULL && y != NULL) {
+        x = _successor(x);
+        y = _successor(y);
+        k++;
+    }
+    return x == NULL ? k : t->s - k;
+}
+
+/*
+    run a set operation over whole trees, the result goes in a
+*/
+STATIC tree* _set_trees(tree* a, tree* b, int op, int threads) {
+    if (!_join_check(a, b)) return NULL;
+    set_op o = {a, op, a->r, _height(a->r), b->r, _height(b->r), threads, NULL, 0, 0};
+    _set_op(&o);
+    a->r = o.r;
+    if (op == SET_UNION) a->s += b->s - o.k;
+    else if (op == SET_INTERSECTION) a->s = o.k;
+    else a->s -= o.k;
+    free(b);
+    return a;
+}
+
+/*
+    split a at b's top value, and do the two sides of b against
+    the two halves of a, on another thread for the left side when
+    there is one to spare and enough work.  then b's top node (or
+    a's for a difference) joins the two results back together,
+    if its count survives the operation
+*/
+STATIC void _set_op(set_op* o) {
+    tree* t = o->t;
+    tree_node* a = o->a;
+    tree_node* b = o->b;
+    o->k = 0;
+    if (a == NULL || b == NULL) {
+        o->r = a != NULL ? a : b;
+        o->h = a != NULL ? o->ha : o->hb;
+        if (o->op == SET_INTERSECTION || (o->op == SET_DIFFERENCE && a == NULL)) {
+            _node_free_all(o->r);
+            o->r = NULL;
+            o->h = 0;
+        }
+        return;
+    }
+    tree_node* bl = b->l;
+    tree_node* br = b->r;
+    if (bl != NULL) bl->p = NULL;
+    if (br != NULL) br->p = NULL;
+    set_op l = {t, o->op, NULL, 0, bl, o->hb - (b->b > 0 ? 2 : 1), 1, NULL, 0, 0};
+    set_op r = {t, o->op, NULL, 0, br, o->hb - (b->b < 0 ? 2 : 1), 1, NULL, 0, 0};
+    tree_node* m = _split(t, a, o->ha, b->d, &l.a, &l.ha, &r.a, &r.ha);
+
+    pthread_t th;
+    bool forked = false;
+    if (o->threads > 1 && o->ha >= TREE_SET_FORK_HEIGHT && o->hb >= TREE_SET_FORK_HEIGHT) {
+        l.threads = o->threads / 2;
+        r.threads = o->threads - l.threads;
+        forked = pthread_create(&th, NULL, _set_op_thread, &l) == 0;
+    }
+    if (!forked) _set_op(&l);
+    _set_op(&r);
+    if (forked) pthread_join(th, NULL);
+
+    o->k = l.k + r.k;
+    tree_node* k = NULL;
+    if (o->op == SET_UNION) {
+        k = b;
+        if (m != NULL) {
+            k->c += m->c;
+            _node_free(t, m);
+            o->k++;
+        }
+    } else if (o->op == SET_INTERSECTION) {
+        if (m != NULL) {
+            k = b;
+            if (m->c < k->c) k->c = m->c;
+            _node_free(t, m);
+            o->k++;
+        } else _node_free(t, b);
+    } else {
+        if (m != NULL && m->c > b->c) {
+            k = m;
+            k->c -= b->c;
+        } else if (m != NULL) {
+            _node_free(t, m);
+            o->k++;
+        }
+        _node_free(t, b);
+    }
+    if (k != NULL) o->r = _join(t, l.r, l.h, k, r.r, r.h, &o->h);
+    else o->r = _join_concat(t, l.r, l.h, r.r, r.h, &o->h);
+}
+
+STATIC void* _set_op_thread(void* arg) {
+    _set_op(arg);
+    return NULL;
+}
+
+/*
+    run f on each of n jobs of size z, on a thread each.  the
+    caller takes the first, and any that can't get a thread
+*/
+STATIC void _build_run(void* (*f)(void*), void* jobs, size_t z, int n) {
+    pthread_t th[n];
+    bool forked[n];
+    for (int i = 1; i < n; i++) {
+        forked[i] = pthread_create(&th[i], NULL, f, (char*) jobs + i * z) == 0;
+    }
+    f(jobs);
+    for (int i = 1; i < n; i++) {
+        if (forked[i]) pthread_join(th[i], NULL);
+        else f((char*) jobs + i * z);
+    }
+}
+
+/*
+    the bucket for v: the number of splitters <= v, so that
+    equal values always share a bucket
+*/
+STATIC int _build_bucket(const long* s, int nb, long v) {
+    int lo = 0;
+    int hi = nb - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (s[mid] <= v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+STATIC void* _build_count(void* arg) {
+    build_sort* b = arg;
+    for (size_t i = 0; i < b->n; i++) {
+        b->at[_build_bucket(b->s, b->nb, b->d[i])]++;
+    }
+    return NULL;
+}
+
+STATIC void* _build_scatter(void* arg) {
+    build_sort* b = arg;
+    for (size_t i = 0; i < b->n; i++) {
+        b->k[b->at[_build_bucket(b->s, b->nb, b->d[i])]++] = b->d[i];
+    }
+    return NULL;
+}
+
+/*
+    sort a bucket and fold its repeats to the front of it
+*/
+STATIC void* _build_fold(void* arg) {
+    build_sort* b = arg;
+    long* k = b->k + b->lo;
+    unsigned* c = b->c + b->lo;
+    size_t n = b->hi - b->lo;
+    qsort(k, n, sizeof(long), _long_cmp);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (m > 0 && k[i] == k[m - 1]) {
+            if (!b->dedup) c[m - 1]++;
+            continue;
+        }
+        k[m] = k[i];
+        c[m] = 1;
+        m++;
+    }
+    b->m = m;
+    return NULL;
+}
+
+/*
+    _build_sorted by index, so the left subtree can be built on
+    another thread while this one builds the right
+*/
+STATIC void* _build_range(void* arg) {
+    build_job* j = arg;
+    size_t m = j->hi - j->lo;
+    if (m == 0) {
+        j->r = NULL;
+        j->h = 0;
+        return NULL;
+    }
+    size_t mid = j->lo + (m - 1) / 2;
+    build_job l = {j->t, j->k, j->c, j->nodes, j->lo, mid, 1, NULL, 0};
+    build_job r = {j->t, j->k, j->c, j->nodes, mid + 1, j->hi, 1, NULL, 0};
+    pthread_t th;
+    bool forked = false;
+    if (j->threads > 1 && m >= TREE_BUILD_FORK) {
+        l.threads = j->threads / 2;
+        r.threads = j->threads - l.threads;
+        forked = pthread_create(&th, NULL, _build_range, &l) == 0;
+    }
+    if (!forked) _build_range(&l);
+    _build_range(&r);
+    if (forked) pthread_join(th, NULL);
+    tree_node* n = j->nodes != NULL ? j->nodes[mid] : _node_new(j->t, j->k[mid]);
+    n->c = j->c[mid];
+    _join_hang(n, l.r, l.h, r.r, r.h);
+    if (j->t->f & TREE_AUGMENTED) _aug_pull(n);
+    j->r = n;
+    j->h = (l.h > r.h ? l.h : r.h) + 1;
+    return NULL;
+}
+
+/*
+    build a perfectly balanced subtree of m distinct keys, taking
+    them in order from in.  the left side gets the smaller half,
+    so b is 0 or 1.  h is set to the height of the subtree
+*/
+STATIC tree_node* _build_sorted(tree* t, sorted_run* in, unsigned long m, int* h) {
+    if (m == 0) {
+        *h = 0;
+        return NULL;
+    }
+    int lh, rh;
+    tree_node* l = _build_sorted(t, in, (m - 1) / 2, &lh);
+    tree_node* n = _node_new(t, in->k[in->i]);
+    n->c = 0;
+    do {
+        n->c += in->c != NULL ? in->c[in->i] : 1;
+        in->i++;
+    } while (in->i < in->n && in->k[in->i] == n->d);
+    tree_node* r = _build_sorted(t, in, m - 1 - (m - 1) / 2, &rh);
+    n->l = l;
+    if (l != NULL) l->p = n;
+    n->r = r;
+    if (r != NULL) r->p = n;
+    n->b = rh - lh;
+    if (t->f & TREE_AUGMENTED) _aug_pull(n);
+    *h = (lh > rh ? lh : rh) + 1;
+    return n;
+}
+
+/*
+    _build_sorted taking keys from in->next.  once that fails it
+    stops making nodes and hands back what it has, still linked,
+    so the caller can free it
+*/
+STATIC tree_node* _build_next(tree* t, build_next* in, unsigned long m, int* h) {
+    if (m == 0 || !in->ok) {
+        *h = 0;
+        return NULL;
+    }
+    int lh, rh;
+    tree_node* l = _build_next(t, in, (m - 1) / 2, &lh);
+    long d;
+    unsigned c;
+    if (in->ok && (!in->next(&d, &c, in->arg) || c == 0 || (in->any && d <= in->last))) in->ok = false;
+    if (!in->ok) {
+        *h = lh;
+        return l;
+    }
+    in->any = true;
+    in->last = d;
+    tree_node* n = _node_new(t, d);
+    n->c = c;
+    tree_node* r = _build_next(t, in, m - 1 - (m - 1) / 2, &rh);
+    _join_hang(n, l, lh, r, rh);
+    if (t->f & TREE_AUGMENTED) _aug_pull(n);
+    *h = (lh > rh ? lh : rh) + 1;
+    return n;
+}
+
+/*
+    build a perfectly balanced subtree of m nodes taken in order
+    off the front of the list l (linked through r), as
+    _build_sorted does from arrays
+*/
+STATIC tree_node* _build_list(tree* t, tree_node** l, unsigned long m, int* h) {
+    if (m == 0) {
+        *h = 0;
+        return NULL;
+    }
+    int lh, rh;
+    tree_node* left = _build_list(t, l, (m - 1) / 2, &lh);
+    tree_node* n = *l;
+    *l = n->r;
+    tree_node* right = _build_list(t, l, m - 1 - (m - 1) / 2, &rh);
+    n->l = left;
+    if (left != NULL) left->p = n;
+    n->r = right;
+    if (right != NULL) right->p = n;
+    n->b = rh - lh;
+    if (t->f & TREE_AUGMENTED) _aug_pull(n);
+    *h = (lh > rh ? lh : rh) + 1;
+    return n;
+}
+
+/*
+    flatten the tree under n into a sorted list linked through r
+    (l all NULL) by rotating left children up, the first phase
+    of day-stout-warren.  O(n) and no stack
+*/
+STATIC tree_node* _vine(tree_node* n) {
+    tree_node head;
+    head.r = n;
+    tree_node* tail = &head;
+    while (n != NULL) {
+        if (n->l == NULL) {
+            tail = n;
+            n = n->r;
+        } else {
+            tree_node* x = n->l;
+            n->l = x->r;
+            x->r = n;
+            n = x;
+            tail->r = x;
+        }
+    }
+    return head.r;
+}
+
+STATIC int _long_cmp(const void* a, const void* b) {
+    long x = *(const long*) a;
+    long y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+    copy and sort a batch, folding duplicates, returns the
+    pairs and sets m to their number.  caller frees
+*/
+STATIC key_count* _batch_sort(const long* d, size_t n, unsigned long* m) {
+    long* k = malloc(sizeof(long) * (n > 0 ? n : 1));
+    Assert(k != NULL, __func__, "malloc error");
+    for (size_t i = 0; i < n; i++) {
+        k[i] = d[i];
+    }
+    qsort(k, n, sizeof(long), _long_cmp);
+    key_count* b = malloc(sizeof(key_count) * (n > 0 ? n : 1));
+    Assert(b != NULL, __func__, "malloc error");
+    unsigned long j = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && k[i] == k[i - 1]) {
+            b[j - 1].c += 1;
+            continue;
+        }
+        b[j].d = k[i];
+        b[j].c = 1;
+        j++;
+    }
+    free(k);
+    *m = j;
+    return b;
+}
+
+/*
+    whether a batch of m distinct keys is better applied by
+    merging with the whole tree and rebuilding it (O(n + m),
+    rebalanced once) than by one descent per key
+*/
+STATIC bool _batch_merge(tree* t, unsigned long m) {
+    return m > 0 && m * TREE_BATCH_MERGE_RATIO >= t->s;
+}
+
+/*
+    merge the sorted batch into the tree's nodes and rebuild
+*/
+STATIC void _merge_insert(tree* t, key_count* b, unsigned long m) {
+    tree_node* l = _vine(t->r);
+    tree_node head;
+    tree_node* tail = &head;
+    unsigned long i = 0;
+    unsigned long s = 0;
+    while (l != NULL || i < m) {
+        tree_node* x;
+        if (l != NULL && (i == m || l->d <= b[i].d)) {
+            x = l;
+            l = l->r;
+            if (i < m && x->d == b[i].d) x->c += b[i++].c;
+        } else {
+            x = _node_new(t, b[i].d);
+            x->c = b[i++].c;
+        }
+        tail->r = x;
+        tail = x;
+        s++;
+    }
+    tail->r = NULL;
+    l = head.r;
+    int h;
+    t->r = _build_list(t, &l, s, &h);
+    if (t->r != NULL) t->r->p = NULL;
+    t->s = s;
+}
+
+/*
+    take the sorted batch's counts out of the tree's nodes,
+    dropping emptied nodes, and rebuild.  returns the
+    number of counts removed
+*/
+STATIC unsigned long _merge_remove(tree* t, key_count* b, unsigned long m) {
+    tree_node* l = _vine(t->r);
+    tree_node head;
+    tree_node* tail = &head;
+    unsigned long i = 0;
+    unsigned long s = 0;
+    unsigned long removed = 0;
+    while (l != NULL) {
+        tree_node* x = l;
+        l = l->r;
+        while (i < m && b[i].d < x->d) i++;
+        if (i < m && b[i].d == x->d) {
+            if (x->c <= b[i].c) {
+                removed += x->c;
+                _node_free(t, x);
+                continue;
+            }
+            x->c -= b[i].c;
+            removed += b[i].c;
+        }
+        tail->r = x;
+        tail = x;
+        s++;
+    }
+    tail->r = NULL;
+    l = head.r;
+    int h;
+    t->r = _build_list(t, &l, s, &h);
+    if (t->r != NULL) t->r->p = NULL;
+    t->s = s;
+    return removed;
+}
+
+/*
+    remove node n (whatever its count) from the tree, rebalance,
+    update the root and size, and free it
+*/
+STATIC void _remove_node(tree* t, tree_node* n) {
+    if (n->p == NULL && n->l == NULL && n->r == NULL) {
+        Assert(t->s == 1, __func__, "root deletion, but size wrong, %lu", t->s);
+        t->r = NULL;
+        _node_free(t, n);
+        t->s = 0;
+        return;
+    }
+
+    /*
+        x is the lowest node whose subtree changes, aggregates
+        are repaired from there up once the retrace is done.
+        s is the node that takes n's place
+    */
+    tree_node* r;
+    tree_node* x;
+    tree_node* s;
+    if (n->r == NULL && n->l == NULL) {
+        x = n->p;
+        s = NULL;
+        r = _remove_no_children(n);
+    } else if (n->r == NULL) {
+        x = n->l;
+        s = n->l;
+        r = _remove_no_right_children(n);
+    } else if (n->r != NULL && n->r->l == NULL) {
+        x = n->r;
+        s = n->r;
+        r = _remove_right_no_left(n);
+    } else if (n->r != NULL && n->r->l != NULL) {
+        s = _leftmost(n->r);
+        x = s->p;
+        r = _remove_complex(n);
+    } else Assert(false, __func__, "unhandled node removal");
+    // the root moved if a rotation reached it, or n was the root
+    if (r->p == NULL) t->r = r;
+    else if (t->r == n) t->r = s;
+    _node_free(t, n);
+    t->s -= 1;
+    _aug_fix(t, x);
+}
+
+/*
+    in-order neighbours, by way of the parent pointers
+*/
+STATIC tree_node* _leftmost(tree_node* n) {
+    if (n == NULL) return NULL;
+    while (n->l != NULL) n = n->l;
+    return n;
+}
+
+STATIC tree_node* _rightmost(tree_node* n) {
     if (n == NULL) return NULL;
-    while (n->p != NULL) {
+    while (n->r != NULL) n = n->r;
+    return n;
+}
+
+STATIC tree_node* _successor(tree_node* n) {
+    if (n->r != NULL) return _leftmost(n->r);
+    while (n->p != NULL && n->p->r == n) n = n->p;
+    return n->p;
+}
+
+STATIC tree_node* _predecessor(tree_node* n) {
+    if (n->l != NULL) return _rightmost(n->l);
+    while (n->p != NULL && n->p->l == n) n = n->p;
+    return n->p;
+}
+
+/*
+    order statistic aggregates (TREE_AUGMENTED)
+
+    rotations only change the subtrees of the nodes they turn,
+    and those are all on the retrace path or hang directly off
+    of it with untouched children.  so rather than teach every
+    rotation about the node layout, the aggregates are rebuilt
+    in one pass up from the lowest changed node once retracing
+    is done: at each level, pull the child we didn't come from
+    (it may have been rotated off the path) and then the node
+*/
+STATIC void _aug_pull(tree_node* n) {
+    tree_anode* a = (tree_anode*) n;
+    a->s = 1;
+    a->w = n->c;
+    if (n->l != NULL) {
+        a->s += ((tree_anode*) n->l)->s;
+        a->w += ((tree_anode*) n->l)->w;
+    }
+    if (n->r != NULL) {
+        a->s += ((tree_anode*) n->r)->s;
+        a->w += ((tree_anode*) n->r)->w;
+    }
+}
+
+STATIC void _aug_fix(tree* t, tree_node* n) {
+    if (!(t->f & TREE_AUGMENTED)) return;
+    tree_node* c = NULL;
+    while (n != NULL) {
+        if (n->l != NULL && n->l != c) _aug_pull(n->l);
+        if (n->r != NULL && n->r != c) _aug_pull(n->r);
+        _aug_pull(n);
+        c = n;
         n = n->p;
     }
-    LOG_DEBUG("root: %li", __func__, n->d);
+}
+
+/*
+    values (or distinct values) < d, and the node holding the
+    k-th value, using the subtree aggregates
+*/
+STATIC unsigned long _rank(tree* t, long d, bool distinct) {
+    Assert(t->f & TREE_AUGMENTED, __func__, "tree not augmented");
+    if (!(t->f & TREE_AUGMENTED)) return 0;
+    tree_node* n = _get_root(t);
+    unsigned long r = 0;
+    while (n != NULL) {
+        if (d <= n->d) {
+            n = n->l;
+        } else {
+            if (n->l != NULL) r += distinct ? ((tree_anode*) n->l)->s : ((tree_anode*) n->l)->w;
+            r += distinct ? 1 : n->c;
+            n = n->r;
+        }
+    }
+    return r;
+}
+
+STATIC tree_node* _select(tree* t, unsigned long k, bool distinct) {
+    Assert(t->f & TREE_AUGMENTED, __func__, "tree not augmented");
+    if (!(t->f & TREE_AUGMENTED)) return NULL;
+    tree_node* n = _get_root(t);
+    while (n != NULL) {
+        unsigned long l = 0;
+        if (n->l != NULL) l = distinct ? ((tree_anode*) n->l)->s : ((tree_anode*) n->l)->w;
+        unsigned long c = distinct ? 1 : n->c;
+        if (k < l) {
+            n = n->l;
+        } else if (k < l + c) {
+            return n;
+        } else {
+            k -= l + c;
+            n = n->r;
+        }
+    }
+    return NULL;
+}
+
+/*
+    _insert_attach for augmented trees.  the new node adds to
+    every subtree on the way down, so count it in first, while
+    the path is still hot.  an insert rotates at most once, at
+    the node the retrace stops at, so only that node and its
+    children need pulling afterwards
+*/
+STATIC tree_node* _aug_insert_attach(tree_node* n, tree_node* c) {
+    for (tree_node* x = n; x != NULL; x = x->p) {
+        ((tree_anode*) x)->s += 1;
+        ((tree_anode*) x)->w += c->c;
+    }
+    _aug_pull(c);
+    LOG_DEBUG("inserting: %li", __func__, c->d);
+    if (c->d < n->d) n->l = c;
+    else n->r = c;
+    c->p = n;
+    tree_node* p = _retrace_insert(c);
+    if (p->l != NULL) _aug_pull(p->l);
+    if (p->r != NULL) _aug_pull(p->r);
+    _aug_pull(p);
+    return p;
+}
+
+/*
+    nearest rank (from 0) of quantile q among w values
+*/
+STATIC unsigned long _quantile_rank(double q, unsigned long w) {
+    if (!(q > 0)) return 0; // and NaN
+    if (q >= 1) return w - 1;
+    double k = q * w;
+    unsigned long r = (unsigned long) k;
+    if ((double) r < k) r++; // ceil
+    return r > 0 ? r - 1 : 0;
+}
+
+STATIC int _rank_want_cmp(const void* a, const void* b) {
+    unsigned long x = ((const rank_want*) a)->k;
+    unsigned long y = ((const rank_want*) b)->k;
+    return (x > y) - (x < y);
+}
+
+/*
+    select for n sorted ranks at once: split them between the
+    left subtree, n itself and the right subtree, so shared
+    upper levels are only visited once.  off is the weight of
+    everything to the left of n's subtree
+*/
+STATIC void _select_many(tree_node* n, rank_want* wants, size_t m, unsigned long off, tree_node** out) {
+    while (n != NULL && m > 0) {
+        unsigned long l = off + (n->l != NULL ? ((tree_anode*) n->l)->w : 0);
+        size_t i = 0;
+        while (i < m && wants[i].k < l) i++;
+        if (i > 0) _select_many(n->l, wants, i, off, out);
+        while (i < m && wants[i].k < l + n->c) out[wants[i++].i] = n;
+        // carry on to the right without recursing
+        wants += i;
+        m -= i;
+        off = l + n->c;
+        n = n->r;
+    }
+    for (size_t i = 0; i < m; i++) out[wants[i].i] = NULL;
+}
+
+/*
+    only a count changed, add dc to the weights up the tree
+*/
+STATIC void _aug_add(tree* t, tree_node* n, long dc) {
+    if (!(t->f & TREE_AUGMENTED)) return;
+    while (n != NULL) {
+        ((tree_anode*) n)->w += dc;
+        n = n->p;
+    }
+}
+
+/*
+    some helper functions
+*/
+tree_node* _get_root(tree* t) {
+    Assert(t != NULL, __func__, "tree is null");
+    return t->r;
+}
+
+STATIC tree_node* _node_new(tree* t, long d) {
+    if (t->a != NULL) return slab_node_new(t->a, d);
+    if (!(t->f & TREE_AUGMENTED)) return tree_node_new(d);
+    tree_node* n = malloc(_node_size(t));
+    Assert(n != NULL, __func__, "malloc error");
+    n->p = NULL;
+    n->l = NULL;
+    n->r = NULL;
+    n->d = d;
+    n->c = 1;
+    n->b = 0;
     return n;
 }
+
+STATIC size_t _node_size(tree* t) {
+    if (t->f & TREE_AUGMENTED) return sizeof(tree_anode);
+    return sizeof(tree_node);
+}
+
+STATIC void _node_free(tree* t, tree_node* n) {
+    if (t->a != NULL) slab_node_free(t->a, n);
+    else free(n);
+}
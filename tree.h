@@ -1,11 +1,21 @@
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "../queue/queue.h"
 #include "../tree-node/tree_node.h"
 
+#include "slab.h"
+
 #ifndef TREE_H
 #define TREE_H
 
+/*
+    flags for tree_new_flags
+*/
+#define TREE_SLAB 0x1 // allocate nodes from a tree owned slab
+#define TREE_AUGMENTED 0x2 // keep subtree counts, for rank/select
+#define TREE_BUILD_DEDUP 0x4 // tree_build only: one of each value, not their count
+
 typedef struct tree tree;
 struct tree {
     tree_node* r; // root node
@@ -14,8 +24,111 @@ struct tree {
         elements in the tree, not the total count
     */
     unsigned long s;
+    unsigned f; // flags, see above
+    slab* a; // node allocator when TREE_SLAB, otherwise NULL
+};
+
+/*
+    build a tree from n values in any order, with the given TREE_*
+    flags.  the values are sample sorted over up to threads threads,
+    repeats folded into counts, and the tree is built top down with
+    the big subtrees on the threads too.  d is left as it is
+*/
+tree* tree_build(const long* d, size_t n, unsigned f, int threads);
+
+/*
+    tree_build_sorted_flags from a source of m distinct keys rather
+    than arrays: next is called for each key and its count, in
+    order, and returns false if there are no more.  NULL if it runs
+    out early, or the keys don't ascend, or a count is 0
+*/
+tree* tree_build_next(unsigned long m, bool (*next)(long* d, unsigned* c, void* arg), void* arg, unsigned f);
+
+/*
+    build a balanced tree from n keys in non-decreasing order in
+    O(n).  counts[i] is the count for keys[i] (or NULL for one
+    each); adjacent duplicates are folded into a single node
+*/
+tree* tree_build_sorted(const long* keys, const unsigned* counts, size_t n);
+
+/*
+    tree_build_sorted, into a tree with the given TREE_* flags
+*/
+tree* tree_build_sorted_flags(const long* keys, const unsigned* counts, size_t n, unsigned f);
+
+/*
+    nearest nodes to d, or NULL if there is none:
+        ceiling     smallest value >= d (the same as lower bound)
+        floor       largest value <= d
+*/
+tree_node* tree_ceiling(tree* t, long d);
+tree_node* tree_floor(tree* t, long d);
+
+/*
+    concatenate l and r, where every value in l is less than every
+    value in r, as tree_join with r's smallest value in the middle.
+    l and r are consumed.  O(log n).  NULL as for tree_join
+*/
+tree* tree_concat(tree* l, tree* r);
+
+/*
+    the number of values in [lo, hi), counting repeats (the sum
+    of c).  TREE_AUGMENTED only, O(log n)
+*/
+unsigned long tree_count_range(tree* t, long lo, long hi);
+
+/*
+    in-order cursor.  lives on the caller's stack and walks the
+    parent pointers, so it allocates nothing and yields the first
+    node right away.  any insert or remove on the tree invalidates
+    it.  once a cursor steps off either end it stays there (n is
+    NULL) until repositioned
+*/
+typedef struct tree_cursor tree_cursor;
+struct tree_cursor {
+    tree* t;
+    tree_node* n; // current node
 };
 
+/*
+    position at the smallest / largest node, returns it
+*/
+tree_node* tree_cursor_first(tree_cursor* c, tree* t);
+tree_node* tree_cursor_last(tree_cursor* c, tree* t);
+
+/*
+    step to the next / previous node in order, returns it
+*/
+tree_node* tree_cursor_next(tree_cursor* c);
+tree_node* tree_cursor_prev(tree_cursor* c);
+
+/*
+    position at the first node with a value >= d, returns it
+*/
+tree_node* tree_cursor_seek(tree_cursor* c, tree* t, long d);
+
+/*
+    set operations on the values and their counts: union adds the
+    counts, intersection keeps the smaller and difference takes b's
+    from a's, dropping any that reach 0.  a and b must have the same
+    flags, neither TREE_SLAB, or the result is NULL and they are left
+    alone.  otherwise they are consumed, their nodes make up the
+    result.  join based, O(m log(n / m + 1)) for sizes m <= n,
+    with the top of the recursion split over up to threads threads
+    on big trees
+*/
+tree* tree_difference(tree* a, tree* b, int threads);
+tree* tree_intersection(tree* a, tree* b, int threads);
+tree* tree_union(tree* a, tree* b, int threads);
+
+/*
+    histogram of the values over n buckets: counts[i] is the
+    number of values in [edges[i], edges[i + 1]), so edges holds
+    n + 1 ascending bounds.  TREE_AUGMENTED only, O(n log size).
+    returns the number of values that fell in any bucket
+*/
+unsigned long tree_histogram(tree* t, const long* edges, size_t n, unsigned long* counts);
+
 /*
     in-order on the tree, returns queue of nodes
 */
@@ -26,31 +139,112 @@ queue* tree_inorder(tree* t);
 */
 void tree_insert(tree* t, long d);
 
+/*
+    insert n (unsorted) values at once.  the batch is sorted and
+    folded first; big batches are merged with the tree and it is
+    rebuilt once, small ones are applied in key order
+*/
+void tree_insert_batch(tree* t, const long* d, size_t n);
+
+/*
+    join l, d and r into one tree, where every value in l is < d
+    and every value in r is > d.  d goes in once.  l and r must
+    have the same flags, neither TREE_SLAB, and are consumed.
+    O(the difference in their heights).  NULL, leaving l and r
+    alone, if their flags don't allow it
+*/
+tree* tree_join(tree* l, long d, tree* r);
+
+/*
+    first node with a value >= d, or NULL
+*/
+tree_node* tree_lower_bound(tree* t, long d);
+
 /*
     create a tree
 */
 tree* tree_new();
 
+/*
+    create a tree with the given TREE_* flags
+*/
+tree* tree_new_flags(unsigned f);
+
 /*
     print a tree
 */
 void tree_print(tree* t);
 
+/*
+    the node holding the q quantile (q in [0, 1]) of the values,
+    counting repeats, by nearest rank.  NULL if the tree is empty.
+    TREE_AUGMENTED only, O(log n)
+*/
+tree_node* tree_quantile(tree* t, double q);
+
+/*
+    n quantiles in one pass down the tree, out[i] gets the node
+    for qs[i].  qs need not be sorted
+*/
+void tree_quantiles(tree* t, const double* qs, size_t n, tree_node** out);
+
+/*
+    call f on each node with a value in [lo, hi), in order, until
+    f returns false.  O(log n + k), returns the number of nodes
+    passed to f.  f must not change the tree
+*/
+unsigned long tree_range(tree* t, long lo, long hi, bool (*f)(tree_node* n, void* arg), void* arg);
+
+/*
+    rank: number of values < d.  _distinct counts each value once
+*/
+unsigned long tree_rank(tree* t, long d);
+unsigned long tree_rank_distinct(tree* t, long d);
+
 /*
     remove a value, returns bool indicating whether removed
 */
 bool tree_remove(tree* t, long d);
 
+/*
+    remove n (unsorted) values at once, as tree_insert_batch.
+    returns the number of values removed
+*/
+unsigned long tree_remove_batch(tree* t, const long* d, size_t n);
+
 /*
     search for a value, returns the node
 */
 tree_node* tree_search(tree* t, long d);
 
+/*
+    select: the node holding the k-th smallest value (from 0),
+    or NULL if k is past the end.  _distinct counts each value
+    once
+*/
+tree_node* tree_select(tree* t, unsigned long k);
+tree_node* tree_select_distinct(tree* t, unsigned long k);
+
 /*
     get the size of the tree
 */
 unsigned long tree_size(tree* t);
 
+/*
+    split t at d: values < d go to *l and the rest to *r, two new
+    trees with t's flags.  t is consumed.  false, leaving t alone,
+    if it's TREE_SLAB.
+    O(log n) when t is TREE_AUGMENTED.  otherwise the halves' sizes
+    have to be counted, which makes it O(log n + min(|l|, |r|)),
+    and O(n) at worst
+*/
+bool tree_split(tree* t, long d, tree** l, tree** r);
+
+/*
+    first node with a value > d, or NULL
+*/
+tree_node* tree_upper_bound(tree* t, long d);
+
 /*
     free all the nodes in the tree, and the tree
 */
@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "release.h"
+#include "../tree-node/tree_node.h"
+
+#include "tree.h"
+#include "frozen.h"
+#include "snapshot.h"
+#include "wal.h"
+
+_Static_assert(sizeof(wal_header) == 64, "wal header isn't 64 bytes");
+
+/*
+    a frame is a 4 byte count, that many records of an op byte and
+    an 8 byte key, and an 8 byte sum of everything before it
+*/
+#define WAL_INSERT 1
+#define WAL_REMOVE 2
+#define WAL_RECORD 9
+#define WAL_FRAME(n) (4 + (n) * WAL_RECORD + 8)
+
+wal_options wal_defaults() {
+    wal_options o = {WAL_SYNC_GROUP, 1024, 10000000ULL, 1UL << 20, 0};
+    return o;
+}
+
+static unsigned long long _wal_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t _wal_sum(const unsigned char* b, size_t z) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < z; i++) h = (h ^ b[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static char* _wal_name(const char* path, const char* ext) {
+    size_t z = strlen(path), e = strlen(ext);
+    char* s = malloc(z + e + 1);
+    Assert(s != NULL, __func__, "malloc error");
+    memcpy(s, path, z);
+    memcpy(s + z, ext, e + 1);
+    return s;
+}
+
+static bool _wal_write(int fd, const unsigned char* b, size_t z) {
+    while (z > 0) {
+        ssize_t k = write(fd, b, z);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        b += k;
+        z -= (size_t) k;
+    }
+    return true;
+}
+
+/*
+    the sum of the snapshot at path, from its header, which is
+    what a log names as its base
+*/
+static bool _wal_base(const char* path, uint64_t* base) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) return false;
+    snapshot_header h;
+    bool ok = fread(&h, sizeof(h), 1, in) == 1;
+    fclose(in);
+    if (ok) *base = h.sum;
+    else errno = EINVAL;
+    return ok;
+}
+
+/*
+    replace the log with an empty one following base, by way of
+    path.wal.tmp and a rename, and open it to append
+*/
+static bool _wal_start(wtree* w, uint64_t base) {
+    char* tmp = _wal_name(w->wal, ".tmp");
+    wal_header h = {WAL_MAGIC, WAL_VERSION, SNAPSHOT_ORDER, base, {0}};
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && _wal_write(fd, (unsigned char*) &h, sizeof(h)) && fsync(fd) == 0;
+    if (fd >= 0) ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, w->wal) == 0 && snapshot_sync_dir(w->wal);
+    if (!ok) {
+        int e = errno;
+        unlink(tmp);
+        errno = e;
+    }
+    free(tmp);
+    if (!ok) return false;
+    if (w->fd >= 0) close(w->fd);
+    w->fd = open(w->wal, O_WRONLY | O_APPEND);
+    return w->fd >= 0;
+}
+
+/*
+    true, with errno set, once the log has failed
+*/
+static bool _wal_failed(wtree* w) {
+    if (w->err != 0) errno = w->err;
+    return w->err != 0;
+}
+
+/*
+    write out the frame being filled, and fsync it if asked.  a
+    failure is kept in w->err and stops the logging
+*/
+static bool _wal_flush(wtree* w, bool sync) {
+    if (w->err != 0) return false;
+    if (w->n > 0) {
+        uint32_t n = (uint32_t) w->n;
+        memcpy(w->b, &n, 4);
+        uint64_t h = _wal_sum(w->b, w->z);
+        memcpy(w->b + w->z, &h, 8);
+        bool ok = _wal_write(w->fd, w->b, w->z + 8);
+        w->n = 0;
+        w->z = 4;
+        if (!ok) {
+            w->err = errno;
+            return false;
+        }
+    }
+    if (sync && fdatasync(w->fd) != 0) {
+        w->err = errno;
+        return false;
+    }
+    return true;
+}
+
+/*
+    add a record to the frame, and write it when the sync mode
+    says to, false if the log has failed and the update mustn't be
+    applied.  the group age is only checked here, so an idle tree's
+    last few updates wait for the next one (or a sync)
+*/
+static bool _wal_log(wtree* w, unsigned char op, long d) {
+    if (_wal_failed(w)) return false;
+    w->b[w->z] = op;
+    memcpy(w->b + w->z + 1, &d, 8);
+    w->z += WAL_RECORD;
+    if (w->n++ == 0 && w->o.sync != WAL_SYNC_ALWAYS) w->first = _wal_now();
+    if (w->o.sync == WAL_SYNC_ALWAYS) _wal_flush(w, true);
+    else if (w->n >= w->o.group || _wal_now() - w->first >= w->o.interval) _wal_flush(w, w->o.sync == WAL_SYNC_GROUP);
+    return !_wal_failed(w);
+}
+
+/*
+    after an update is applied, checkpoint if it's time, false if
+    that fails
+*/
+static bool _wal_applied(wtree* w) {
+    if (w->o.checkpoint > 0 && ++w->since >= w->o.checkpoint) return wtree_checkpoint(w);
+    return true;
+}
+
+/*
+    replay path.wal on top of w->t if it follows base, cutting off
+    a torn tail.  only removes that hit are logged, so doing all the
+    inserts first can only raise the count a remove sees, and it
+    still hits: the whole log goes in as one sorted insert batch and
+    then one remove batch, whatever the mix.  starts a new log if
+    there's none or it's stale
+*/
+static bool _wal_replay(wtree* w, uint64_t base) {
+    int fd = open(w->wal, O_RDWR);
+    if (fd < 0) return errno == ENOENT && _wal_start(w, base);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t z = (size_t) st.st_size;
+    unsigned char* b = malloc(z + 1);
+    Assert(b != NULL, __func__, "malloc error");
+    size_t got = 0;
+    while (got < z) {
+        ssize_t k = read(fd, b + got, z - got);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) break;
+        got += (size_t) k;
+    }
+    wal_header h;
+    if (got < sizeof(h)) memset(&h, 0, sizeof(h));
+    else memcpy(&h, b, sizeof(h));
+    if (memcmp(h.magic, WAL_MAGIC, sizeof(h.magic)) != 0 || h.version != WAL_VERSION || h.order != SNAPSHOT_ORDER) {
+        free(b);
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    if (h.base != base) {
+        // the checkpoint made it to disk but its new log didn't
+        free(b);
+        close(fd);
+        return _wal_start(w, base);
+    }
+    // inserts from the front of k, removes from the back
+    size_t m = (got - sizeof(h)) / WAL_RECORD;
+    long* k = malloc((m + 1) * sizeof(long));
+    Assert(k != NULL, __func__, "malloc error");
+    size_t i = sizeof(h), a = 0, r = m;
+    while (got - i >= WAL_FRAME(0)) {
+        uint32_t n;
+        memcpy(&n, b + i, 4);
+        if (n == 0 || (got - i - WAL_FRAME(0)) / WAL_RECORD < n) break;
+        uint64_t sum;
+        memcpy(&sum, b + i + WAL_FRAME(n) - 8, 8);
+        if (_wal_sum(b + i, WAL_FRAME(n) - 8) != sum) break;
+        for (const unsigned char* x = b + i + 4; x < b + i + 4 + n * WAL_RECORD; x += WAL_RECORD) {
+            memcpy(&k[*x == WAL_INSERT ? a++ : --r], x + 1, 8);
+        }
+        i += WAL_FRAME(n);
+        w->since += n;
+    }
+    tree_insert_batch(w->t, k, a);
+    tree_remove_batch(w->t, k + r, m - r);
+    free(k);
+    free(b);
+    // later frames go after the last good one
+    bool ok = (i == z || (ftruncate(fd, (off_t) i) == 0 && fsync(fd) == 0));
+    close(fd);
+    if (!ok) return false;
+    w->fd = open(w->wal, O_WRONLY | O_APPEND);
+    return w->fd >= 0;
+}
+
+wtree* wtree_open(const char* path, const wal_options* o) {
+    wtree* w = malloc(sizeof(wtree));
+    Assert(w != NULL, __func__, "malloc error");
+    w->o = o != NULL ? *o : wal_defaults();
+    if (w->o.group == 0) w->o.group = 1;
+    if (w->o.sync == WAL_SYNC_ALWAYS) w->o.group = 1;
+    w->snap = _wal_name(path, ".snap");
+    w->wal = _wal_name(path, ".wal");
+    w->fd = -1;
+    w->b = malloc(WAL_FRAME(w->o.group));
+    Assert(w->b != NULL, __func__, "malloc error");
+    w->z = 4;
+    w->n = 0;
+    w->first = 0;
+    w->since = 0;
+    w->err = 0;
+
+    uint64_t base = 0;
+    errno = 0;
+    frozen* f = tree_open_mmap_verified(w->snap);
+    if (f != NULL) {
+        base = ((snapshot_header*) f->m)->sum;
+        w->t = frozen_thaw(f, w->o.flags);
+        frozen_free(f);
+    } else if (errno == ENOENT) {
+        w->t = tree_new_flags(w->o.flags);
+    } else {
+        w->t = NULL;
+    }
+    if (w->t == NULL || !_wal_replay(w, base)) {
+        int e = errno != 0 ? errno : EINVAL;
+        if (w->fd >= 0) close(w->fd);
+        if (w->t != NULL) _tree_free(w->t);
+        free(w->b);
+        free(w->snap);
+        free(w->wal);
+        free(w);
+        errno = e;
+        return NULL;
+    }
+    return w;
+}
+
+bool wtree_insert(wtree* w, long d) {
+    if (!_wal_log(w, WAL_INSERT, d)) return false;
+    tree_insert(w->t, d);
+    return _wal_applied(w);
+}
+
+bool wtree_remove(wtree* w, long d) {
+    if (_wal_failed(w) || tree_search(w->t, d) == NULL) return false;
+    if (!_wal_log(w, WAL_REMOVE, d)) return false;
+    tree_remove(w->t, d);
+    return _wal_applied(w);
+}
+
+int wtree_error(wtree* w) {
+    return w->err;
+}
+
+tree* wtree_tree(wtree* w) {
+    return w->t;
+}
+
+bool wtree_sync(wtree* w) {
+    bool ok = _wal_flush(w, true);
+    if (!ok) errno = w->err;
+    return ok;
+}
+
+bool wtree_checkpoint(wtree* w) {
+    // the log has to be whole first, in case the snapshot fails
+    uint64_t base;
+    if (!wtree_sync(w)) return false;
+    if (!tree_save(w->t, w->snap) || !_wal_base(w->snap, &base) || !_wal_start(w, base)) {
+        w->err = errno;
+        return false;
+    }
+    w->since = 0;
+    return true;
+}
+
+bool wtree_close(wtree* w) {
+    bool ok = wtree_sync(w);
+    int e = errno;
+    if (w->fd >= 0) close(w->fd);
+    _tree_free(w->t);
+    free(w->b);
+    free(w->snap);
+    free(w->wal);
+    free(w);
+    errno = e;
+    return ok;
+}
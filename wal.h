@@ -0,0 +1,123 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+#ifndef TREE_WAL_H
+#define TREE_WAL_H
+
+/*
+    a tree with a write-ahead log.  every insert and remove is
+    logged before it's applied, and opening replays the log on top
+    of the last checkpoint, so a crash loses at most the updates
+    that weren't yet synced.  on disk it's two files:
+
+        path.snap   a snapshot (see snapshot.h), the last checkpoint
+        path.wal    the updates since, in frames of records
+
+    the log header names the snapshot it follows by its checksum,
+    so a log left over from before a checkpoint is never replayed
+    on top of the snapshot that already has it.  each frame is a
+    count, the records and a checksum, so a frame torn by a crash
+    is found and cut off
+*/
+#define WAL_MAGIC "AVLWLOG"
+#define WAL_VERSION 1
+
+/*
+    when log writes reach the disk, the durability/latency trade
+*/
+#define WAL_SYNC_ALWAYS 0 // fsync each update before it returns
+#define WAL_SYNC_GROUP 1 // fsync a group of updates at a time, when full or old enough
+#define WAL_SYNC_NONE 2 // write a group at a time, leave syncing to the os
+
+typedef struct wal_options wal_options;
+struct wal_options {
+    int sync; // WAL_SYNC_*
+    unsigned long group; // updates per frame, and per fsync for WAL_SYNC_GROUP
+    unsigned long long interval; // ns an update can wait for its group to fill
+    unsigned long checkpoint; // updates between checkpoints, 0 for none
+    unsigned flags; // TREE_* flags for the tree
+};
+
+typedef struct wal_header wal_header;
+struct wal_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t order; // SNAPSHOT_ORDER as the writer saw it
+    uint64_t base; // checksum of the snapshot this follows, 0 for none
+    uint8_t pad[40];
+};
+
+typedef struct wtree wtree;
+struct wtree {
+    tree* t;
+    wal_options o;
+    char* snap; // the file names
+    char* wal;
+    int fd; // the log, open to append
+    unsigned char* b; // the frame being filled
+    size_t z;
+    unsigned long n; // updates in it
+    unsigned long long first; // when the first of them came in
+    unsigned long since; // updates since the last checkpoint
+    int err; // errno of the first failed log write or checkpoint, which stops updates
+};
+
+/*
+    the defaults: group sync of 1024 updates or 10ms, and a
+    checkpoint every 1M updates
+*/
+wal_options wal_defaults();
+
+/*
+    open the tree at path, replaying its log, or start an empty one.
+    NULL, with errno set, if the files can't be read or written
+*/
+wtree* wtree_open(const char* path, const wal_options* o);
+
+/*
+    insert d, false with errno set if the log has failed.  once a
+    log write or a checkpoint fails the tree takes no more updates,
+    so it never runs ahead of a log that stopped.  an update is
+    applied only after it's logged, but a checkpoint fails after,
+    so the update it follows stays in the tree.  updates already
+    applied whose group hadn't reached the log may be lost
+*/
+bool wtree_insert(wtree* w, long d);
+
+/*
+    remove one instance of d, true if there was one.  misses
+    aren't logged.  false too if the log has failed, as for
+    wtree_insert, which wtree_error tells from a miss
+*/
+bool wtree_remove(wtree* w, long d);
+
+/*
+    the errno of the failure that stopped updates, 0 while the
+    log is good
+*/
+int wtree_error(wtree* w);
+
+/*
+    the tree, for reading.  changes must go through wtree_*
+*/
+tree* wtree_tree(wtree* w);
+
+/*
+    write and fsync everything logged so far.  false if any log
+    write has failed since the open, with errno set
+*/
+bool wtree_sync(wtree* w);
+
+/*
+    snapshot the tree and start a new log, false as wtree_sync
+*/
+bool wtree_checkpoint(wtree* w);
+
+/*
+    sync and free everything, false as wtree_sync
+*/
+bool wtree_close(wtree* w);
+
+#endif //TREE_WAL_H